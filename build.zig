@@ -32,12 +32,17 @@ pub fn build(b: *std.Build) void {
     dll.addCSourceFiles(.{ .files = &.{
         "src/API.cpp",
         "src/Dx.cpp",
+        "src/FramePacer.cpp",
         "src/Globals.cpp",
+        "src/MatrixKernels.cpp",
         "src/Menu.cpp",
         "src/OpenVR.cpp",
         "src/OpenXR.cpp",
         "src/RBR.cpp",
         "src/RenderTarget.cpp",
+        "src/ShaderBytecode.cpp",
+        "src/ShaderCache.cpp",
+        "src/SpirvWorker.cpp",
         "src/VR.cpp",
         "src/Vertex.cpp",
         "src/Util.cpp",
@@ -88,8 +93,83 @@ pub fn build(b: *std.Build) void {
 
     b.installArtifact(dll);
 
+    // Tests and benchmarks of the platform independent parts, built for and run on the host
+    const test_step = b.step("test", "Run the tests on the host");
+    const bench_step = b.step("bench", "Run the benchmarks on the host");
+
+    const shader_bytecode_test = addHostExecutable(b, "shader_bytecode_test", &.{ "tests/ShaderBytecodeTest.cpp", "src/ShaderBytecode.cpp" }, .Debug);
+    test_step.dependOn(&b.addRunArtifact(shader_bytecode_test).step);
+
+    const shader_map_test = addHostExecutable(b, "shader_map_test", &.{"tests/ShaderMapTest.cpp"}, .Debug);
+    test_step.dependOn(&b.addRunArtifact(shader_map_test).step);
+
+    // Stand-in OpenXR runtime for the frame loop test, next to the manifest the test loads it with
+    const xr_stub_runtime = b.addLibrary(.{
+        .name = "xr_stub_runtime",
+        .linkage = .dynamic,
+        .root_module = b.createModule(.{
+            .target = b.graph.host,
+            .optimize = .Debug,
+        }),
+    });
+    xr_stub_runtime.linkLibCpp();
+    xr_stub_runtime.addCSourceFiles(.{ .files = &.{"tests/XrStubRuntime.cpp"}, .flags = &.{
+        "--std=c++23",
+        "-fvisibility=hidden",
+    } });
+    xr_stub_runtime.addIncludePath(b.path("tests"));
+    xr_stub_runtime.addIncludePath(.{ .cwd_relative = "thirdparty/openxr" });
+
+    const xr_stub_runtime_files = b.addWriteFiles();
+    _ = xr_stub_runtime_files.addCopyFile(xr_stub_runtime.getEmittedBin(), xr_stub_runtime.out_filename);
+    const xr_stub_runtime_manifest = xr_stub_runtime_files.add("xr_stub_runtime.json", b.fmt(
+        \\{{
+        \\    "file_format_version": "1.0.0",
+        \\    "runtime": {{
+        \\        "name": "openRBRVR stub runtime",
+        \\        "library_path": "{s}"
+        \\    }}
+        \\}}
+        \\
+    , .{xr_stub_runtime.out_filename}));
+
+    const frame_pacer_test = addHostExecutable(b, "frame_pacer_test", &.{ "tests/FramePacerTest.cpp", "src/FramePacer.cpp" }, .Debug);
+    frame_pacer_test.addIncludePath(b.path("tests"));
+    frame_pacer_test.addIncludePath(.{ .cwd_relative = "thirdparty/openxr" });
+    const frame_pacer_test_run = b.addRunArtifact(frame_pacer_test);
+    frame_pacer_test_run.addFileArg(xr_stub_runtime_manifest);
+    test_step.dependOn(&frame_pacer_test_run.step);
+
+    const shader_map_bench = addHostExecutable(b, "shader_map_bench", &.{"tests/ShaderMapBench.cpp"}, .ReleaseFast);
+    bench_step.dependOn(&b.addRunArtifact(shader_map_bench).step);
+
+    const btb_constant_bench = addHostExecutable(b, "btb_constant_bench", &.{"tests/BTBConstantBench.cpp"}, .ReleaseFast);
+    bench_step.dependOn(&b.addRunArtifact(btb_constant_bench).step);
+
+    const matrix_kernels_bench = addHostExecutable(b, "matrix_kernels_bench", &.{ "tests/MatrixKernelsBench.cpp", "src/MatrixKernels.cpp" }, .ReleaseFast);
+    bench_step.dependOn(&b.addRunArtifact(matrix_kernels_bench).step);
+
     // For compile_commands.json
     var targets: std.ArrayListUnmanaged(*std.Build.Step.Compile) = .empty;
     targets.append(b.allocator, dll) catch @panic("OOM");
     _ = zcc.createStep(b, "cdb", targets.toOwnedSlice(b.allocator) catch @panic("OOM"));
 }
+
+fn addHostExecutable(b: *std.Build, name: []const u8, files: []const []const u8, optimize: std.builtin.OptimizeMode) *std.Build.Step.Compile {
+    const exe = b.addExecutable(.{
+        .name = name,
+        .root_module = b.createModule(.{
+            .target = b.graph.host,
+            .optimize = optimize,
+        }),
+    });
+    exe.linkLibCpp();
+    exe.addCSourceFiles(.{ .files = files, .flags = &.{
+        "--std=c++23",
+        // The DLL target has no FMA. Fused glm products would not match the matrix kernels.
+        "-ffp-contract=off",
+    } });
+    exe.addIncludePath(b.path("src"));
+    exe.addIncludePath(.{ .cwd_relative = "thirdparty/glm" });
+    return exe;
+}
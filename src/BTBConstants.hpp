@@ -0,0 +1,88 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstdint>
+
+// Matrix passed to a BTB shader constant register
+enum class BTBConstant : uint8_t {
+    Unknown,
+    World,
+    Projection,
+    View,
+    ProjView,
+    ViewProj,
+    WorldView,
+    WorldViewProj,
+    Other,
+};
+
+// Learned matrix of a BTB shader float constant register
+struct BTBConstantEntry {
+    BTBConstant constant;
+    // Hash of the data that was classified as BTBConstant::Other
+    uint32_t other_hash;
+};
+
+// Learned matrices of each float constant register of a BTB shader
+using BTBConstantTable = std::array<BTBConstantEntry, 256>;
+
+// FNV-1a over the 32-bit words of the uploaded data. Much cheaper than comparing the data against all the candidates.
+inline uint32_t btb_constant_hash(const float* data, uint32_t vector4f_count)
+{
+    uint32_t h = 2166136261u;
+    for (uint32_t i = 0; i < vector4f_count * 4; ++i) {
+        h = (h ^ std::bit_cast<uint32_t>(data[i])) * 16777619u;
+    }
+    return h;
+}
+
+// Tests the data against the known candidates with `is_constant`.
+// These are the different ones passed to shaders, gathered from the BTB stage list of RSF.
+// Some custom stages might have other shaders that pass the data in a different format.
+// Those won't work without handling them here, but such is life.
+template <typename IsConstant>
+BTBConstant classify_btb_constant(IsConstant&& is_constant)
+{
+    constexpr BTBConstant candidates[] = {
+        BTBConstant::World,
+        BTBConstant::Projection,
+        BTBConstant::View,
+        BTBConstant::ProjView,
+        BTBConstant::ViewProj,
+        BTBConstant::WorldView,
+        BTBConstant::WorldViewProj,
+    };
+
+    for (const auto c : candidates) {
+        if (is_constant(c)) {
+            return c;
+        }
+    }
+    return BTBConstant::Other;
+}
+
+// Returns the matrix uploaded to the register of `entry`. The data is compared only against the learned matrix,
+// or for BTBConstant::Other only hashed, and classified again if it doesn't match. `classified` is set if it was.
+template <typename IsConstant>
+BTBConstant learn_btb_constant(BTBConstantEntry& entry, const float* data, uint32_t vector4f_count, IsConstant&& is_constant, bool& classified)
+{
+    classified = false;
+    uint32_t hash = 0;
+    if (entry.constant == BTBConstant::Other) {
+        hash = btb_constant_hash(data, vector4f_count);
+        if (hash == entry.other_hash) {
+            return BTBConstant::Other;
+        }
+    } else if (entry.constant != BTBConstant::Unknown && is_constant(entry.constant)) {
+        return entry.constant;
+    }
+
+    classified = true;
+    const auto c = classify_btb_constant(is_constant);
+    if (c == BTBConstant::Other && entry.constant != BTBConstant::Other) {
+        hash = btb_constant_hash(data, vector4f_count);
+    }
+    entry = { c, c == BTBConstant::Other ? hash : 0 };
+    return c;
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+// Compact buffer of recorded calls
+//
+// Each command is a header word with the opcode in the low 8 bits and the number
+// of payload words in the rest, followed by the payload. Values are stored in
+// whole words, so the buffers can be compared word by word.
+class CommandBuffer {
+    std::vector<uint32_t> words;
+    size_t header = 0;
+    size_t count = 0;
+
+    template <typename T>
+    static constexpr size_t word_count(size_t n = 1)
+    {
+        return (sizeof(T) * n + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+    }
+
+public:
+    struct Command {
+        uint8_t op;
+        std::span<const uint32_t> payload;
+    };
+
+    // Reads the payload of a command in the order it was written
+    class Reader {
+        std::span<const uint32_t> payload;
+        size_t pos = 0;
+
+    public:
+        explicit Reader(std::span<const uint32_t> payload)
+            : payload(payload)
+        {
+        }
+
+        template <typename T>
+        T read()
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            T v;
+            std::memcpy(&v, payload.data() + pos, sizeof(T));
+            pos += word_count<T>();
+            return v;
+        }
+
+        // Returns a pointer to `n` values stored with write_array. The values are word aligned.
+        template <typename T>
+        const T* read_array(uint32_t& n)
+        {
+            static_assert(alignof(T) <= alignof(uint32_t));
+            n = read<uint32_t>();
+            const auto p = reinterpret_cast<const T*>(payload.data() + pos);
+            pos += word_count<T>(n);
+            return p;
+        }
+    };
+
+    void begin(uint8_t op)
+    {
+        header = words.size();
+        words.push_back(op);
+    }
+
+    template <typename T>
+    void write(const T& v)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        const auto pos = words.size();
+        words.resize(pos + word_count<T>());
+        std::memcpy(words.data() + pos, &v, sizeof(T));
+    }
+
+    template <typename T>
+    void write_array(const T* p, uint32_t n)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        write(n);
+        const auto pos = words.size();
+        words.resize(pos + word_count<T>(n));
+        std::memcpy(words.data() + pos, p, sizeof(T) * n);
+    }
+
+    void end()
+    {
+        words[header] |= static_cast<uint32_t>(words.size() - header - 1) << 8;
+        count++;
+    }
+
+    // Keeps the allocation for the next recording
+    void clear()
+    {
+        words.clear();
+        count = 0;
+    }
+
+    size_t size() const { return count; }
+    size_t size_bytes() const { return words.size() * sizeof(uint32_t); }
+
+    // Calls `f` with each command in the order they were recorded
+    template <typename F>
+    void for_each(F&& f) const
+    {
+        for (size_t i = 0; i < words.size();) {
+            const auto length = words[i] >> 8;
+            f(Command { static_cast<uint8_t>(words[i] & 0xFF), { words.data() + i + 1, length } });
+            i += 1 + length;
+        }
+    }
+
+    // Index of the first command that differs between the buffers, or std::nullopt if they're equal
+    static std::optional<size_t> first_difference(const CommandBuffer& a, const CommandBuffer& b)
+    {
+        size_t i = 0, j = 0, index = 0;
+        while (i < a.words.size() && j < b.words.size()) {
+            const auto la = a.words[i] >> 8;
+            const auto lb = b.words[j] >> 8;
+            if (a.words[i] != b.words[j] || std::memcmp(a.words.data() + i + 1, b.words.data() + j + 1, la * sizeof(uint32_t)) != 0) {
+                return index;
+            }
+            i += 1 + la;
+            j += 1 + lb;
+            index++;
+        }
+        if (i == a.words.size() && j == b.words.size()) {
+            return std::nullopt;
+        }
+        return index;
+    }
+};
@@ -124,6 +124,14 @@ struct Config {
     struct {
         bool disable_multiview = false;
         int64_t adjust_displaytime_ms = 0;
+        bool filter_redundant_states = false;
+        bool stereo_replay = false;
+        bool stereo_replay_validation = false;
+        bool pipelined_frame_loop = false;
+        bool zero_copy_submission = false;
+        int64_t shared_texture_count = 1;
+        // VRAM budget for the render contexts in megabytes, 0 for no limit
+        int64_t render_context_budget_mb = 0;
     } experimental;
 
     Config& operator=(const Config& rhs)
@@ -210,7 +218,14 @@ struct Config {
             && recenter_at_stage_start == rhs.recenter_at_stage_start
             && threedof == rhs.threedof
             && experimental.disable_multiview == rhs.experimental.disable_multiview
-            && experimental.adjust_displaytime_ms == rhs.experimental.adjust_displaytime_ms;
+            && experimental.adjust_displaytime_ms == rhs.experimental.adjust_displaytime_ms
+            && experimental.filter_redundant_states == rhs.experimental.filter_redundant_states
+            && experimental.stereo_replay == rhs.experimental.stereo_replay
+            && experimental.stereo_replay_validation == rhs.experimental.stereo_replay_validation
+            && experimental.pipelined_frame_loop == rhs.experimental.pipelined_frame_loop
+            && experimental.zero_copy_submission == rhs.experimental.zero_copy_submission
+            && experimental.shared_texture_count == rhs.experimental.shared_texture_count
+            && experimental.render_context_budget_mb == rhs.experimental.render_context_budget_mb;
     }
 
     bool write(const std::filesystem::path& path) const
@@ -292,6 +307,13 @@ struct Config {
         toml::table experimental_node;
         experimental_node.insert("disableMultiView", experimental.disable_multiview);
         experimental_node.insert("adjustDisplayTimeMs", experimental.adjust_displaytime_ms);
+        experimental_node.insert("filterRedundantStates", experimental.filter_redundant_states);
+        experimental_node.insert("stereoReplay", experimental.stereo_replay);
+        experimental_node.insert("stereoReplayValidation", experimental.stereo_replay_validation);
+        experimental_node.insert("pipelinedFrameLoop", experimental.pipelined_frame_loop);
+        experimental_node.insert("zeroCopySubmission", experimental.zero_copy_submission);
+        experimental_node.insert("sharedTextureCount", experimental.shared_texture_count);
+        experimental_node.insert("renderContextBudgetMb", experimental.render_context_budget_mb);
         out.insert("experimental", experimental_node);
 
         f << out;
@@ -397,6 +419,13 @@ struct Config {
         if (experimental_node.is_table()) {
             cfg.experimental.adjust_displaytime_ms = experimental_node["adjustDisplayTimeMs"].value_or(0);
             cfg.experimental.disable_multiview = experimental_node["disableMultiView"].value_or(false);
+            cfg.experimental.filter_redundant_states = experimental_node["filterRedundantStates"].value_or(false);
+            cfg.experimental.stereo_replay = experimental_node["stereoReplay"].value_or(false);
+            cfg.experimental.stereo_replay_validation = experimental_node["stereoReplayValidation"].value_or(false);
+            cfg.experimental.pipelined_frame_loop = experimental_node["pipelinedFrameLoop"].value_or(false);
+            cfg.experimental.zero_copy_submission = experimental_node["zeroCopySubmission"].value_or(false);
+            cfg.experimental.shared_texture_count = std::clamp<int64_t>(experimental_node["sharedTextureCount"].value_or(1), 1, 4);
+            cfg.experimental.render_context_budget_mb = std::max<int64_t>(experimental_node["renderContextBudgetMb"].value_or(0), 0);
         }
 
         return cfg;
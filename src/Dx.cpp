@@ -1,21 +1,66 @@
 #include "Dx.hpp"
+#include "BTBConstants.hpp"
+#include "CommandBuffer.hpp"
 #include "Globals.hpp"
 #include "IPlugin.h"
+#include "MatrixKernels.hpp"
 #include "OpenVR.hpp"
 #include "OpenXR.hpp"
 #include "RBR.hpp"
+#include "ShaderBytecode.hpp"
+#include "ShaderCache.hpp"
+#include "ShaderMap.hpp"
+#include "SpirvWorker.hpp"
 #include "Util.hpp"
 #include "Version.hpp"
 
 #include <algorithm>
 #include <array>
-#include <gtx/matrix_decompose.hpp>
+#include <bitset>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <unordered_map>
 #include <unordered_set>
+#include <utility>
 
 using MultiViewAddFn = int (*)(uint32_t*, uint32_t, uint32_t*, uint32_t*);
 using MultiViewPatchFn = int (*)(uint32_t*, uint32_t, uint32_t*, uint32_t*, uint32_t, uint32_t, int8_t);
 using MultiViewOptimizeFn = int (*)(uint32_t*, uint32_t, uint32_t*, uint32_t*);
 
+// Multiview copy of a shader, shared by all the shaders created from the same bytecode
+struct MultiviewTwin {
+    std::vector<DWORD> bytecode;
+    IDirect3DVertexShader9* shader;
+    uint32_t constant_table;
+};
+
+// Multiview twins by the hash of the original bytecode
+using MultiviewTwinIndex = std::unordered_multimap<uint64_t, MultiviewTwin>;
+
+// Draws that are skipped in some situations
+enum class DrawCategory : uint8_t {
+    Keep,
+    // Black transparent square drawn in front of the car when car shadows are enabled
+    CockpitShadowQuad,
+    WetWindscreen,
+    // Shader #39 on BTB stages
+    BTBShadow,
+    Count,
+};
+
+// The state a draw call is classified by
+struct DrawSignature {
+    IDirect3DVertexShader9* shader;
+    IDirect3DBaseTexture9* texture;
+    INT base_vertex_index;
+    UINT count;
+    D3DPRIMITIVETYPE type;
+    bool indexed;
+
+    bool operator==(const DrawSignature&) const = default;
+};
+
 // Compilation unit global variables
 namespace g {
     static std::chrono::steady_clock::time_point second_start;
@@ -30,19 +75,497 @@ namespace g {
     static MultiViewOptimizeFn spirv_optimize_multiview;
     static std::vector<IDirect3DVertexShader9*> original_btb_shaders;
     static std::vector<IDirect3DVertexShader9*> multiview_btb_shaders;
+    static ShaderMap shaders;
     static std::unordered_map<IDirect3DVertexShader9*, std::vector<uint32_t>> patched_btb_shaders;
     static std::unordered_set<IDirect3DVertexShader9*> optimized_btb_shaders;
-    static std::unordered_map<uint32_t, std::array<float, 16>> deferred_shader_constants;
     static int failed_multiview_base_game_shaders;
     static int failed_multiview_external_shaders;
     static int failed_multiview_btb_shaders;
     static int failed_multiview_btb_shader_optimizations;
+    static SpirvWorker* spirv_worker;
+    static uint64_t btb_shader_generation;
+    static int btb_shader_optimizations_queued;
+    static int btb_shader_optimizations_applied;
+    static std::vector<BTBConstantTable> btb_constant_tables;
+    static MultiviewTwinIndex external_multiview_twins;
+    static MultiviewTwinIndex btb_multiview_twins;
+    static int shared_multiview_shaders;
+    static int btb_constant_classifications;
+    static int shadow_state_mismatches;
+    static int projection_inverse_hits;
+    static int projection_inverse_misses;
+    static int btb_comparison_products_computed;
+    static int btb_comparison_products_consumed;
+    static int btb_comparison_products_computed_last_frame;
+    static int btb_comparison_products_consumed_last_frame;
 }
 
 namespace dx {
     namespace shader {
         static M4 current_projection_matrix;
         static M4 current_projection_matrix_inverse;
+
+        // The game sets the same few projections (stage, cockpit, menu) over and over again
+        struct ProjectionInverse {
+            D3DMATRIX projection;
+            M4 inverse;
+            bool valid;
+        };
+        static std::array<ProjectionInverse, 8> projection_inverses;
+        static size_t next_projection_inverse;
+    }
+
+    // Device state followed through the hooked setters
+    // The per-draw hooks read the state from here instead of querying it from the device,
+    // which would be a COM call and a reference count round trip each time.
+    // The values are not reference counted, the device holds a reference while they are bound.
+    namespace shadow {
+        static IDirect3DVertexShader9* vertex_shader;
+        static std::array<IDirect3DBaseTexture9*, 8> textures;
+        static IDirect3DSurface9* render_target;
+        static IDirect3DSurface9* depth_stencil_surface;
+
+        // Set calls between BeginStateBlock and EndStateBlock are recorded, and don't change the device state
+        static bool recording_state_block;
+    }
+
+    // Last values forwarded to the device, used for dropping Set*State calls that wouldn't change anything
+    // The game runs its render function once per view, so a lot of the state changes are repeated.
+    namespace state_filter {
+        template <size_t N>
+        struct StateCache {
+            std::array<DWORD, N> values;
+            std::bitset<N> valid;
+
+            bool contains(size_t i, DWORD value) const { return valid[i] && values[i] == value; }
+            void set(size_t i, DWORD value)
+            {
+                values[i] = value;
+                valid[i] = true;
+            }
+            void invalidate() { valid.reset(); }
+        };
+
+        // D3DRS_BLENDOPALPHA is the last render state
+        static StateCache<256> render_states;
+        // Samplers 0-15, the displacement map sampler and the four vertex texture samplers, D3DSAMP_DMAPOFFSET is the last sampler state
+        static StateCache<21 * 14> sampler_states;
+        // 8 stages, D3DTSS_CONSTANT is the last texture stage state
+        static StateCache<8 * 33> texture_stage_states;
+
+        static int forwarded;
+        static int filtered;
+        static int forwarded_last_frame;
+        static int filtered_last_frame;
+
+        static void invalidate()
+        {
+            render_states.invalidate();
+            sampler_states.invalidate();
+            texture_stage_states.invalidate();
+        }
+
+        static std::optional<size_t> sampler_state_index(DWORD sampler, D3DSAMPLERSTATETYPE type)
+        {
+            if (type >= 14) {
+                return std::nullopt;
+            }
+            if (sampler < 16) {
+                return sampler * 14 + type;
+            }
+            if (sampler >= D3DDMAPSAMPLER && sampler <= D3DVERTEXTEXTURESAMPLER3) {
+                return (16 + sampler - D3DDMAPSAMPLER) * 14 + type;
+            }
+            return std::nullopt;
+        }
+
+        static std::optional<size_t> texture_stage_state_index(DWORD stage, D3DTEXTURESTAGESTATETYPE type)
+        {
+            if (stage >= 8 || type >= 33) {
+                return std::nullopt;
+            }
+            return stage * 33 + type;
+        }
+
+        static std::optional<size_t> render_state_index(D3DRENDERSTATETYPE state)
+        {
+            if (state >= 256) {
+                return std::nullopt;
+            }
+            return state;
+        }
+
+        // Forward the state change with `set` unless the state already has `value`
+        template <size_t N, typename F>
+        static HRESULT set_state(StateCache<N>& cache, std::optional<size_t> index, DWORD value, F&& set)
+        {
+            // Values set while a state block is applied or recorded don't go through here in a way that can be tracked
+            const auto trackable = index && !g::applying_state_block && !shadow::recording_state_block;
+            if (trackable && g::cfg.experimental.filter_redundant_states) {
+                if (cache.contains(index.value(), value)) {
+                    filtered++;
+                    return D3D_OK;
+                }
+                forwarded++;
+            }
+
+            const auto ret = set();
+            if (trackable && SUCCEEDED(ret)) {
+                cache.set(index.value(), value);
+            }
+            return ret;
+        }
+    }
+
+    // Shadow of the float vertex shader constant registers, including the multiview data above g::base_shader_data_end_register.
+    // The same matrices are uploaded for every draw that uses them, so uploads that wouldn't change the registers are skipped.
+    namespace constants {
+        constexpr size_t register_count = 512;
+        static std::array<float, register_count * 4> registers;
+        static std::bitset<register_count> valid;
+
+        // Matrices set while no shader is bound, uploaded when the next shader is bound
+        static std::array<std::array<float, 16>, 256> deferred;
+        static std::bitset<256> deferred_registers;
+
+        static int skipped_uploads;
+        static int skipped_uploads_last_frame;
+
+        static void invalidate()
+        {
+            valid.reset();
+        }
+
+        static HRESULT upload(UINT reg, const float* data, UINT count)
+        {
+            // Values set while recording a state block don't end up in the registers until the block is applied
+            const auto tracked = reg + count <= register_count && !shadow::recording_state_block;
+            if (tracked) {
+                auto unchanged = std::memcmp(&registers[reg * 4], data, count * 4 * sizeof(float)) == 0;
+                for (auto i = reg; unchanged && i < reg + count; ++i) {
+                    unchanged = valid[i];
+                }
+                if (unchanged) {
+                    skipped_uploads++;
+                    return D3D_OK;
+                }
+            }
+
+            const auto ret = g::hooks::set_vertex_shader_constant_f.call(g::d3d_dev, reg, data, count);
+            if (tracked && SUCCEEDED(ret)) {
+                std::memcpy(&registers[reg * 4], data, count * 4 * sizeof(float));
+                for (auto i = reg; i < reg + count; ++i) {
+                    valid[i] = true;
+                }
+            }
+            return ret;
+        }
+    }
+
+    // Cache of draw categories by the draw signature
+    // The entries are valid for one frame, so shaders and textures released and created at the same address
+    // and changes to the car texture registry are picked up on the next frame.
+    namespace draw_classifier {
+        struct Entry {
+            DrawSignature signature;
+            uint32_t frame;
+            DrawCategory category;
+        };
+
+        static std::array<Entry, 1024> entries;
+        // Entries with frame 0 have never been used
+        static uint32_t frame = 1;
+
+        static std::array<int, static_cast<size_t>(DrawCategory::Count)> skipped;
+        static std::array<int, static_cast<size_t>(DrawCategory::Count)> skipped_last_frame;
+
+        static size_t slot(const DrawSignature& s)
+        {
+            auto h = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(s.shader) >> 3);
+            h = h * 31 + static_cast<uint32_t>(reinterpret_cast<uintptr_t>(s.texture) >> 3);
+            h = h * 31 + static_cast<uint32_t>(s.base_vertex_index);
+            h = h * 31 + s.count;
+            h = h * 31 + s.type * 2 + s.indexed;
+            return (h * 2654435769u) >> (32 - 10);
+        }
+
+        static DrawCategory classify(const DrawSignature& s)
+        {
+            if (s.indexed) {
+                if (!s.shader && !s.texture) {
+                    return DrawCategory::CockpitShadowQuad;
+                }
+                // TODO: This method of detecting the windscreen is quite bad.
+                //
+                // It would be better to detect it from the texture I think.
+                // However, the texture is such that it is not loaded in the hooked
+                // load_texture function. Any texture that is loaded there is known not to be the windscreen.
+                if (s.base_vertex_index == 0 && s.count == 4 && !rbr::is_car_texture(s.texture)) {
+                    return DrawCategory::WetWindscreen;
+                }
+            } else if (s.shader && g::base_game_shaders.size() > 39 && s.shader == g::base_game_shaders[39]) {
+                return DrawCategory::BTBShadow;
+            }
+            return DrawCategory::Keep;
+        }
+
+        static DrawCategory category(const DrawSignature& s)
+        {
+            auto& e = entries[slot(s)];
+            if (e.frame != frame || !(e.signature == s)) [[unlikely]] {
+                e = { s, frame, classify(s) };
+            }
+            return e.category;
+        }
+
+        static bool should_skip(DrawCategory c)
+        {
+            switch (c) {
+                case DrawCategory::CockpitShadowQuad:
+                    // The square is only visible outside of the cockpit camera
+                    return g::vr_render_target && !rbr::is_using_cockpit_camera();
+                case DrawCategory::WetWindscreen:
+                    // We can't render the windscreen for two reasons:
+                    // - The windscreen needs to be rendered with cockpit projection to not clip it too early,
+                    //   but doing so makes its Z-values be wrong compared to the stage. Maybe another projection
+                    //   for it would work, but here comes the second point:
+                    // - It looks pretty bad anyway, and it is just a 2D plane floating somewhere in front of the
+                    //   opening for a windscreen. In VR where your FoV is large the effect does not really work
+                    //   that well.
+                    return g::vr_render_target && rbr::is_rendering_wet_windscreen();
+                case DrawCategory::BTBShadow:
+                    // Shader #39 causes strange "shadows" on BTB stages
+                    // Clearly visible during CFH, and otherwise visible too when looking up
+                    // Probably some projection matrix issue, but changing the projection matrix like
+                    // we do normally had no effect, so on BTB stages we just won't draw this primitive with this shader.
+                    // With multiview this bug seems to not occur so we also do this exception when multiview isn't enabled.
+                    return rbr::is_on_btb_stage() && !multiview_rendering_enabled();
+                default:
+                    return false;
+            }
+        }
+
+        // Returns true if the draw should be skipped
+        static bool skip(const DrawSignature& s)
+        {
+            const auto c = category(s);
+            if (c == DrawCategory::Keep) [[likely]] {
+                return false;
+            }
+            if (!should_skip(c)) {
+                return false;
+            }
+            skipped[static_cast<size_t>(c)]++;
+            return true;
+        }
+    }
+
+    // BTB shaders patched in advance during the stage load
+    namespace stage_load {
+        // Shaders submitted to the SPIR-V worker and not applied yet
+        static std::unordered_set<IDirect3DVertexShader9*> pending;
+        static int queued;
+        static int cached;
+        static int applied;
+        static int failed;
+        // Worker time that would otherwise have been spent patching and optimizing the shaders while driving
+        static std::chrono::microseconds patch_time;
+    }
+
+    // Device calls of the first eye of a stereo pair, replayed for the other eye instead of running the game's
+    // render function again. The calls are replayed through the hooks with the other eye as the render target,
+    // so the view dependent transforms and shader constants are calculated again for the other eye.
+    namespace stereo_replay {
+        enum class Op : uint8_t {
+            SetTransform,
+            SetVertexShaderConstantF,
+            SetPixelShaderConstantF,
+            SetRenderState,
+            SetSamplerState,
+            SetTextureStageState,
+            SetTexture,
+            SetVertexShader,
+            SetPixelShader,
+            SetVertexDeclaration,
+            SetFVF,
+            SetStreamSource,
+            SetIndices,
+            SetViewport,
+            SetMaterial,
+            SetLight,
+            LightEnable,
+            SetRenderTarget,
+            SetDepthStencilSurface,
+            Clear,
+            DrawPrimitive,
+            DrawIndexedPrimitive,
+            ApplyStateBlock,
+            SetScissorRect,
+            SetVertexShaderConstantI,
+            SetVertexShaderConstantB,
+            SetPixelShaderConstantI,
+            SetPixelShaderConstantB,
+            SetClipPlane,
+            SetStreamSourceFreq,
+            WriteVertexBuffer,
+            WriteIndexBuffer,
+        };
+
+        // Surfaces of the eye being rendered are recorded as references to the eye, and resolved to the
+        // surfaces of the other eye when replayed.
+        enum class SurfaceKind : uint32_t {
+            Literal,
+            EyeRenderTarget,
+            EyeDepthStencil,
+        };
+
+        struct SurfaceRef {
+            SurfaceKind kind;
+            IDirect3DSurface9* surface;
+        };
+
+        template <typename T>
+        struct Array {
+            const T* data;
+            uint32_t count;
+        };
+
+        // Buffer locked for writing while recording. The written data is recorded when the buffer is unlocked.
+        struct BufferWrite {
+            void* buffer;
+            UINT offset;
+            UINT size;
+            DWORD flags;
+            const void* data;
+        };
+
+        static CommandBuffer recorded;
+        // Calls of a real traversal of the second eye, compared against the replayed ones
+        static CommandBuffer validation;
+        // Buffer the hooks are recording to, null when not recording
+        static CommandBuffer* target;
+        static std::vector<BufferWrite> buffer_writes;
+        // Eye whose calls are recorded
+        static RenderTarget eye;
+        // Set when the render function did something that can't be replayed
+        static bool unsupported;
+        static bool replaying;
+        // Set while the hooks call each other, so the nested calls aren't recorded twice
+        static bool suppress;
+
+        static int replayed;
+        static int fallbacks;
+        static int mismatches;
+        static size_t recorded_last_frame;
+        static size_t recorded_bytes_last_frame;
+
+        static bool is_recording()
+        {
+            return target && !replaying && !suppress && !g::applying_state_block;
+        }
+
+        static void mark_unsupported()
+        {
+            if (is_recording()) {
+                unsupported = true;
+            }
+        }
+
+        template <typename T>
+        static void write_arg(const T& v)
+        {
+            target->write(v);
+        }
+
+        template <typename T>
+        static void write_arg(const Array<T>& a)
+        {
+            target->write_array(a.data, a.count);
+        }
+
+        template <typename... Args>
+        static void record(Op op, const Args&... args)
+        {
+            if (!is_recording()) {
+                return;
+            }
+            target->begin(static_cast<uint8_t>(op));
+            (write_arg(args), ...);
+            target->end();
+        }
+
+        static SurfaceRef surface_ref(IDirect3DSurface9* s)
+        {
+            if (const auto ctx = g::vr->get_current_render_context(); ctx && s) {
+                if (s == ctx->dx_surface[eye]) {
+                    return { SurfaceKind::EyeRenderTarget, nullptr };
+                }
+                if (s == ctx->dx_depth_stencil_surface[eye]) {
+                    return { SurfaceKind::EyeDepthStencil, nullptr };
+                }
+            }
+            return { SurfaceKind::Literal, s };
+        }
+
+        static IDirect3DSurface9* resolve_surface(const SurfaceRef& ref, RenderTarget tgt)
+        {
+            const auto ctx = g::vr->get_current_render_context();
+            switch (ref.kind) {
+                case SurfaceKind::EyeRenderTarget: return ctx->dx_surface[tgt];
+                case SurfaceKind::EyeDepthStencil: return ctx->dx_depth_stencil_surface[tgt];
+                default: return ref.surface;
+            }
+        }
+
+        static void begin_buffer_write(void* buffer, UINT offset, UINT size, DWORD flags, const void* data)
+        {
+            if (!is_recording()) {
+                return;
+            }
+            for (const auto& w : buffer_writes) {
+                if (w.buffer == buffer) {
+                    // Locking the same buffer twice before unlocking it
+                    unsupported = true;
+                    return;
+                }
+            }
+            buffer_writes.push_back({ buffer, offset, size, flags, data });
+        }
+
+        // Records the data written to `buffer` since it was locked. Must be called before the buffer is unlocked.
+        static void end_buffer_write(Op op, void* buffer)
+        {
+            const auto it = std::find_if(buffer_writes.begin(), buffer_writes.end(), [buffer](const BufferWrite& w) { return w.buffer == buffer; });
+            if (it == buffer_writes.end()) {
+                return;
+            }
+            if (!is_recording()) {
+                // The write would be missing from the recording
+                unsupported = true;
+                buffer_writes.erase(it);
+                return;
+            }
+            record(op, buffer, it->offset, it->flags, Array<uint8_t> { static_cast<const uint8_t*>(it->data), it->size });
+            buffer_writes.erase(it);
+        }
+
+        static void begin(CommandBuffer& buffer, RenderTarget tgt)
+        {
+            buffer.clear();
+            target = &buffer;
+            eye = tgt;
+            unsupported = false;
+        }
+
+        static void end()
+        {
+            if (!buffer_writes.empty()) {
+                // Writes still in progress are not in the recording
+                unsupported = true;
+                buffer_writes.clear();
+            }
+            target = nullptr;
+        }
     }
 
     namespace fixedfunction {
@@ -53,6 +576,8 @@ namespace dx {
         static D3DMATRIX current_viewproj_matrix[4];
         static D3DMATRIX current_worldview_matrix[4];
         static D3DMATRIX current_worldviewproj_matrix[4];
+        // Bit for each render target whose product matrices above are out of date
+        static uint32_t dirty_comparison_matrices = 0xF;
     }
 
     using rbr::GameMode;
@@ -60,9 +585,11 @@ namespace dx {
     void free_btb_shaders()
     {
         for (auto& s : g::original_btb_shaders) {
+            g::shaders.erase(s);
             s->Release();
         }
         for (auto& s : g::multiview_btb_shaders) {
+            g::shaders.erase(s);
             s->Release();
         }
 
@@ -70,16 +597,71 @@ namespace dx {
         g::multiview_btb_shaders.clear();
         g::optimized_btb_shaders.clear();
         g::patched_btb_shaders.clear();
+        g::btb_constant_tables.clear();
+        g::btb_multiview_twins.clear();
+        stage_load::pending.clear();
+        stage_load::queued = 0;
+        stage_load::cached = 0;
+        stage_load::applied = 0;
+        stage_load::failed = 0;
+        stage_load::patch_time = {};
+
+        // Results for the released shaders may still be coming from the SPIR-V worker
+        g::btb_shader_generation++;
     }
 
     // Call the RBR render function with a texture as the render target
     // Even though the render pipeline changes the render target while rendering,
     // the original render target is respected and restored at the end of the pipeline.
+    static void replay_stereo_commands(const CommandBuffer& buffer, RenderTarget eye);
+
+    // Renders the eye, recording the device calls of the first eye of a pair for
+    // the other one and replaying them instead of rendering the other eye again
+    static void render_vr_eye_with_replay(void* p, RenderTarget eye)
+    {
+        if (eye == LeftEye || eye == FocusLeft) {
+            stereo_replay::begin(stereo_replay::recorded, eye);
+            g::hooks::render.call(p);
+            stereo_replay::end();
+            return;
+        }
+
+        const auto counterpart = render_target_counterpart(eye);
+        if (stereo_replay::eye != counterpart || stereo_replay::unsupported || stereo_replay::recorded.size() == 0) {
+            stereo_replay::fallbacks++;
+            g::hooks::render.call(p);
+        } else if (!g::cfg.experimental.stereo_replay_validation) {
+            replay_stereo_commands(stereo_replay::recorded, eye);
+            stereo_replay::replayed++;
+        } else {
+            // Render the eye for real and check that the calls match the recorded ones
+            stereo_replay::begin(stereo_replay::validation, eye);
+            g::hooks::render.call(p);
+            stereo_replay::end();
+            if (stereo_replay::unsupported) {
+                stereo_replay::fallbacks++;
+            } else if (const auto i = CommandBuffer::first_difference(stereo_replay::recorded, stereo_replay::validation); i) {
+                if (stereo_replay::mismatches++ < 10) {
+                    dbg(std::format("Stereo replay mismatch at command {} of {} (eye {})", i.value(), stereo_replay::recorded.size(), static_cast<int>(eye)));
+                }
+            }
+        }
+
+        // The recording is only valid for the frame it was made on
+        stereo_replay::recorded_last_frame = stereo_replay::recorded.size();
+        stereo_replay::recorded_bytes_last_frame = stereo_replay::recorded.size_bytes();
+        stereo_replay::recorded.clear();
+    }
+
     void render_vr_eye(void* p, RenderTarget eye, bool clear)
     {
         g::vr_render_target = eye;
         if (g::vr->prepare_vr_rendering(g::d3d_dev, eye, clear)) {
-            g::hooks::render.call(p);
+            if (g::cfg.experimental.stereo_replay && !multiview_rendering_enabled()) {
+                render_vr_eye_with_replay(p, eye);
+            } else {
+                g::hooks::render.call(p);
+            }
             g::vr->finish_vr_rendering(g::d3d_dev, eye);
         } else {
             dbg("Failed to set 3D render target");
@@ -89,7 +671,14 @@ namespace dx {
         g::vr_render_target = std::nullopt;
     }
 
-    static bool optimize_spirv_shader(IDirect3DVertexShader9* s)
+    static std::string get_shader_hash(IDirect3DVertexShader9* s)
+    {
+        char hash[64] = { 0 };
+        g::d3d_vr->GetShaderHash(s, (char**)&hash);
+        return std::string(hash, strnlen(hash, sizeof(hash)));
+    }
+
+    static std::vector<uint32_t> get_spirv(IDirect3DVertexShader9* s)
     {
         uint32_t spirv_size;
         g::d3d_vr->GetSPIRVShaderCode(s, nullptr, &spirv_size);
@@ -98,6 +687,11 @@ namespace dx {
         spirv.resize(spirv_size);
         g::d3d_vr->GetSPIRVShaderCode(s, spirv.data(), &spirv_size);
 
+        return spirv;
+    }
+
+    static bool optimize_spirv(std::vector<uint32_t>& spirv)
+    {
         uint32_t patched_spirv_size;
         if (g::spirv_optimize_multiview(spirv.data(), spirv.size(), nullptr, &patched_spirv_size) != 0) {
             return false;
@@ -109,20 +703,13 @@ namespace dx {
             return false;
         }
 
-        g::d3d_vr->PatchSPIRVToVertexShader(s, patched_spirv.data(), patched_spirv_size);
-
+        patched_spirv.resize(patched_spirv_size);
+        spirv = std::move(patched_spirv);
         return true;
     }
 
-    static bool patch_spirv_shader(IDirect3DVertexShader9* s, uint32_t f_idx, uint32_t data_start_register, bool optimize)
+    static bool patch_spirv(std::vector<uint32_t>& spirv, uint32_t f_idx, uint32_t data_start_register, bool optimize)
     {
-        uint32_t spirv_size;
-        g::d3d_vr->GetSPIRVShaderCode(s, nullptr, &spirv_size);
-
-        std::vector<uint32_t> spirv;
-        spirv.resize(spirv_size);
-        g::d3d_vr->GetSPIRVShaderCode(s, spirv.data(), &spirv_size);
-
         uint32_t patched_spirv_size;
         if (g::spirv_change_multiview_access(spirv.data(), spirv.size(), nullptr, &patched_spirv_size, f_idx, data_start_register, optimize) != 0) {
             return false;
@@ -134,67 +721,253 @@ namespace dx {
             return false;
         }
 
-        g::d3d_vr->PatchSPIRVToVertexShader(s, patched_spirv.data(), patched_spirv_size);
-
+        patched_spirv.resize(patched_spirv_size);
+        spirv = std::move(patched_spirv);
         return true;
     }
 
-    static bool patch_spirv_shader_registers(IDirect3DVertexShader9* s)
+    // Recipes describe all the patches done to a shader since it was created.
+    // Together with the shader hash they're used as the shader cache key.
+    static std::string patch_recipe(uint32_t f_idx, uint32_t data_start_register, bool optimize)
+    {
+        return std::format("p{}:{}{};", f_idx, data_start_register, optimize ? "o" : "");
+    }
+
+    static std::string btb_patch_recipe(const std::vector<uint32_t>& registers, bool optimized)
+    {
+        std::string recipe;
+        for (const auto reg : registers) {
+            recipe += patch_recipe(reg, g::base_shader_data_end_register, false);
+        }
+        if (optimized) {
+            recipe += "opt;";
+        }
+        return recipe;
+    }
+
+    // Patch the shader with the cached result of `recipe`. Returns std::nullopt if the result is not in the cache.
+    static std::optional<bool> patch_shader_from_cache(IDirect3DVertexShader9* s, const std::string& hash, const std::string& recipe)
+    {
+        shader_cache::Entry entry;
+        switch (shader_cache::lookup(hash, recipe, entry)) {
+            case shader_cache::Status::Hit: {
+                const auto spirv = entry.spirv();
+                g::d3d_vr->PatchSPIRVToVertexShader(s, const_cast<uint32_t*>(spirv.data()), spirv.size());
+                return true;
+            }
+            case shader_cache::Status::KnownFailure:
+                return false;
+            case shader_cache::Status::Miss:
+                break;
+        }
+        return std::nullopt;
+    }
+
+    // Apply `patch` on top of the current SPIR-V code of the shader, or load the result from the shader cache.
+    // `recipe` must describe every patch applied to the shader, including the one done by `patch`.
+    template <typename F>
+    static bool patch_shader_cached(IDirect3DVertexShader9* s, const std::string& recipe, F&& patch)
     {
-        // Make room for the extra data
-        g::d3d_vr->SetShaderConstantCount(s, g::base_shader_data_end_register * 2);
+        const auto hash = get_shader_hash(s);
+        if (const auto cached = patch_shader_from_cache(s, hash, recipe); cached) {
+            return cached.value();
+        }
 
-        // MVP matrix
-        if (!patch_spirv_shader(s, 0, g::base_shader_data_end_register, false)) {
-            char hash[64] = { 0 };
-            g::d3d_vr->GetShaderHash(s, (char**)&hash);
-            dbg(std::format("Error patching a shader: {}", hash));
+        auto spirv = get_spirv(s);
+        if (!patch(spirv)) {
+            shader_cache::store_failure(hash, recipe);
             return false;
         }
 
-        // Skybox/fog
-        if (!patch_spirv_shader(s, 20, g::base_shader_data_end_register, true)) {
-            char hash[64] = { 0 };
-            g::d3d_vr->GetShaderHash(s, (char**)&hash);
-            dbg(std::format("Error patching a shader: {}", hash));
+        g::d3d_vr->PatchSPIRVToVertexShader(s, spirv.data(), spirv.size());
+        shader_cache::store(hash, recipe, spirv);
+
+        return true;
+    }
+
+    // Number of constants a multiview shader needs for its data to be relocated. The data for both views
+    // for register `r` is placed at `g::base_shader_data_end_register + r` and takes 8 registers, or 9 with
+    // the BTB shaders that have an extra Vector4f after the matrix.
+    static uint32_t multiview_constant_count(const ShaderInfo& info)
+    {
+        if (!info.constant_usage_known) {
+            return g::base_shader_data_end_register * 2;
+        }
+        return g::base_shader_data_end_register + info.constant_register_count + 9;
+    }
+
+    static bool patch_spirv_shader_registers(IDirect3DVertexShader9* s)
+    {
+        // Make room for the extra data. Only registers 0 and 20 are relocated.
+        g::d3d_vr->SetShaderConstantCount(s, g::base_shader_data_end_register + 21 + 9);
+
+        // MVP matrix and skybox/fog
+        const auto recipe = patch_recipe(0, g::base_shader_data_end_register, false) + patch_recipe(20, g::base_shader_data_end_register, true);
+        const auto patched = patch_shader_cached(s, recipe, [](std::vector<uint32_t>& spirv) {
+            return patch_spirv(spirv, 0, g::base_shader_data_end_register, false) && patch_spirv(spirv, 20, g::base_shader_data_end_register, true);
+        });
+
+        if (!patched) {
+            dbg(std::format("Error patching a shader: {}", get_shader_hash(s)));
             return false;
         }
 
         return true;
     }
 
-    bool add_vertex_shader(IDirect3DVertexShader9* shader)
+    static SpirvWorker* get_spirv_worker()
     {
-        UINT fn_size;
+        if (!g::spirv_worker) {
+            // Leave some cores for the game and the VR runtime
+            const auto threads = std::clamp<size_t>(std::thread::hardware_concurrency() / 2, 1, 4);
+            // Intentionally never deleted, joining threads while the DLL is unloaded is not safe
+            g::spirv_worker = new SpirvWorker(threads);
+        }
+        return g::spirv_worker;
+    }
+
+    // Patch and optimize a BTB shader created during the stage load for the registers learned when it was used before.
+    // Shaders without learned registers are patched on their first use, as before.
+    static void prepatch_btb_shader(IDirect3DVertexShader9* shader)
+    {
+        const auto hash = get_shader_hash(shader);
+        const auto registers = shader_cache::lookup_registers(hash);
+        if (registers.empty()) {
+            return;
+        }
 
+        // Optimized shaders are not patched for new registers anymore. The shader must not be patched on the
+        // render thread while the worker is working on it either.
+        g::optimized_btb_shaders.insert(shader);
+
+        const auto recipe = btb_patch_recipe(registers, true);
+        if (const auto cached = patch_shader_from_cache(shader, hash, recipe); cached) {
+            if (cached.value()) {
+                stage_load::cached++;
+            } else {
+                // Fall back to patching the shader on its first use
+                g::optimized_btb_shaders.erase(shader);
+            }
+            return;
+        }
+
+        const auto transform = [registers, data_start_register = g::base_shader_data_end_register](std::vector<uint32_t>& spirv) {
+            for (const auto reg : registers) {
+                if (!patch_spirv(spirv, reg, data_start_register, false)) {
+                    return false;
+                }
+            }
+            return optimize_spirv(spirv);
+        };
+        get_spirv_worker()->submit({ shader, g::btb_shader_generation, hash, recipe, get_spirv(shader), transform });
+        stage_load::pending.insert(shader);
+        stage_load::queued++;
+    }
+
+    static std::vector<DWORD> get_vertex_shader_bytecode(IDirect3DVertexShader9* shader)
+    {
+        UINT fn_size;
         if (shader->GetFunction(nullptr, &fn_size) != D3D_OK) {
-            dbg("Failed to get vertex shader function");
-            return false;
+            return {};
         }
 
         std::vector<DWORD> bytecode(fn_size / sizeof(DWORD));
         if (shader->GetFunction(bytecode.data(), &fn_size) != D3D_OK) {
-            dbg("Failed to get vertex shader function");
-            return false;
+            return {};
+        }
+
+        return bytecode;
+    }
+
+    static ShaderInfo analyze_vertex_shader(IDirect3DVertexShader9* shader, ShaderClass cls, const std::vector<DWORD>& bytecode)
+    {
+        ShaderInfo info = { shader, cls, false, 256, false };
+        const auto analysis = dxso::analyze({ reinterpret_cast<const uint32_t*>(bytecode.data()), bytecode.size() });
+        if (!analysis) {
+            dbg("Could not analyze vertex shader bytecode");
+            return info;
         }
 
-        // Pop one off the end as we're adding more bytecode
-        bytecode.pop_back();
+        info.constant_register_count = analysis->constant_register_count;
+        info.constant_usage_known = !analysis->relative_addressing;
+        return info;
+    }
+
+    // Create a copy of the shader for multiview patching
+    static IDirect3DVertexShader9* create_multiview_shader(const std::vector<DWORD>& bytecode)
+    {
+        // Leave out the end token, or the whole bytecode if the length is not known
+        const auto analysis = dxso::analyze({ reinterpret_cast<const uint32_t*>(bytecode.data()), bytecode.size() });
+        const auto length = analysis ? analysis->length : bytecode.size();
+        std::vector<DWORD> multiview_bytecode(bytecode.begin(), bytecode.begin() + (length > 0 ? length - 1 : 0));
 
         // Add a zero-length comment opcode in the shader code to make DXVK
         // handle this as a new shader and not reuse the one we just created
-        bytecode.push_back(65534);
-        bytecode.push_back(65535);
+        multiview_bytecode.push_back(65534);
+        multiview_bytecode.push_back(65535);
+
+        IDirect3DVertexShader9* multiview_shader = nullptr;
+        if (FAILED(g::hooks::create_vertex_shader.call(g::d3d_dev, multiview_bytecode.data(), &multiview_shader))) {
+            return nullptr;
+        }
+        return multiview_shader;
+    }
+
+    // FNV-1a
+    static uint64_t bytecode_hash(const std::vector<DWORD>& bytecode)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        for (const auto dword : bytecode) {
+            for (auto i = 0; i < 4; ++i) {
+                hash ^= (dword >> (8 * i)) & 0xFF;
+                hash *= 1099511628211ull;
+            }
+        }
+        return hash;
+    }
+
+    static const MultiviewTwin* find_multiview_twin(const MultiviewTwinIndex& twins, uint64_t hash, const std::vector<DWORD>& bytecode)
+    {
+        const auto [begin, end] = twins.equal_range(hash);
+        for (auto it = begin; it != end; ++it) {
+            if (it->second.bytecode == bytecode) {
+                return &it->second;
+            }
+        }
+        return nullptr;
+    }
+
+    bool add_vertex_shader(IDirect3DVertexShader9* shader)
+    {
+        const auto bytecode = get_vertex_shader_bytecode(shader);
+        if (bytecode.empty()) {
+            dbg("Failed to get vertex shader function");
+            return false;
+        }
 
         // Treat shaders from other plugins as base game shaders
         // Nobody will want to edit BTB shaders :D
+        const auto info = analyze_vertex_shader(shader, ShaderClass::External, bytecode);
         g::base_game_shaders.push_back(shader);
+        g::shaders.insert(shader, info);
 
         if (!g::cfg.experimental.disable_multiview) {
-            IDirect3DVertexShader9* modified_shader;
-            const auto ret = g::hooks::create_vertex_shader.call(g::d3d_dev, bytecode.data(), &modified_shader);
-            if (patch_spirv_shader_registers(modified_shader)) {
+            // Plugins may create the same shader several times, the copy that's already patched can be reused
+            const auto hash = bytecode_hash(bytecode);
+            if (const auto twin = find_multiview_twin(g::external_multiview_twins, hash, bytecode); twin) {
+                g::base_game_multiview_shaders.push_back(twin->shader);
+                g::shaders.insert(shader, { twin->shader, ShaderClass::External, false, info.constant_register_count, info.constant_usage_known });
+                g::shared_multiview_shaders++;
+                return true;
+            }
+
+            const auto modified_shader = create_multiview_shader(bytecode);
+            const auto fits = !info.constant_usage_known || info.constant_register_count <= g::base_shader_data_end_register;
+            if (modified_shader && fits && patch_spirv_shader_registers(modified_shader)) {
                 g::base_game_multiview_shaders.push_back(modified_shader);
+                g::shaders.insert(shader, { modified_shader, ShaderClass::External, false, info.constant_register_count, info.constant_usage_known });
+                g::shaders.insert(modified_shader, { modified_shader, ShaderClass::External, true, info.constant_register_count, info.constant_usage_known });
+                g::external_multiview_twins.emplace(hash, MultiviewTwin { bytecode, modified_shader, 0 });
             } else {
                 // If the patching fails, just use the original shader
                 // This will probably cause rendering glitches but should not crash the game
@@ -212,13 +985,19 @@ namespace dx {
             if (auto patcher = LoadLibrary("Plugins/openRBRVR/multiviewpatcher.dll"); patcher) {
                 g::spirv_change_multiview_access = reinterpret_cast<MultiViewPatchFn>(GetProcAddress(patcher, "ChangeSPIRVMultiViewDataAccessLocation"));
                 g::spirv_optimize_multiview = reinterpret_cast<MultiViewOptimizeFn>(GetProcAddress(patcher, "OptimizeSPIRV"));
+                shader_cache::init();
             }
         }
 
         static int i = 0;
 
         auto ret = g::hooks::create_vertex_shader.call(g::d3d_dev, pFunction, ppShader);
-        if (i < 40) {
+        if (FAILED(ret)) {
+            return ret;
+        }
+
+        const auto cls = i < 40 ? ShaderClass::Base : ShaderClass::BTB;
+        if (cls == ShaderClass::Base) {
             // These are the base game shaders for RBR that need
             // to be patched with the VR projection.
             g::base_game_shaders.push_back(*ppShader);
@@ -228,46 +1007,85 @@ namespace dx {
             (*ppShader)->AddRef();
         }
 
-        if (!g::cfg.experimental.disable_multiview) {
-            // Determine shader bytecode length. Valid shaders end at double word with value 65535.
-            const DWORD* pp;
-            for (pp = pFunction; *pp != 65535; ++pp) { }
-
-            std::vector<DWORD> bytecode(pFunction, pp);
-
-            // Add a zero-length comment opcode in the shader code to make DXVK
-            // handle this as a new shader and not reuse the one we just created
-            bytecode.push_back(65534);
-            bytecode.push_back(65535);
-
+        // Read the bytecode back from the created shader, as the size of `pFunction` is not known
+        const auto bytecode = get_vertex_shader_bytecode(*ppShader);
+        const auto info = analyze_vertex_shader(*ppShader, cls, bytecode);
+        g::shaders.insert(*ppShader, info);
+
+        const auto hash = cls == ShaderClass::BTB ? bytecode_hash(bytecode) : 0;
+        const auto twin = cls == ShaderClass::BTB ? find_multiview_twin(g::btb_multiview_twins, hash, bytecode) : nullptr;
+        if (!g::cfg.experimental.disable_multiview && twin) {
+            // Stages often create the same shader several times. Share the multiview copy, including its
+            // patches and learned constants, with the shader created first. Each reference is released
+            // separately in free_btb_shaders.
+            twin->shader->AddRef();
+            g::multiview_btb_shaders.push_back(twin->shader);
+            g::shaders.insert(*ppShader, { twin->shader, cls, false, info.constant_register_count, info.constant_usage_known, twin->constant_table });
+            g::shared_multiview_shaders++;
+        } else if (!g::cfg.experimental.disable_multiview) {
             // Create the same shader again for multiview patching
-            IDirect3DVertexShader9* multiview_shader;
-            ret |= g::hooks::create_vertex_shader.call(g::d3d_dev, bytecode.data(), &multiview_shader);
+            auto multiview_shader = bytecode.empty() ? nullptr : create_multiview_shader(bytecode);
+            if (!multiview_shader) {
+                dbg("Failed to create multiview shader");
+                multiview_shader = *ppShader;
+                multiview_shader->AddRef();
+            }
 
-            if (i < 40) {
+            if (cls == ShaderClass::Base) {
                 g::base_game_multiview_shaders.push_back(multiview_shader);
             } else {
                 g::multiview_btb_shaders.push_back(multiview_shader);
             }
+
+            if (multiview_shader == *ppShader) {
+                if (cls == ShaderClass::BTB) {
+                    g::failed_multiview_btb_shaders++;
+                }
+            } else if (cls == ShaderClass::BTB && info.constant_usage_known && info.constant_register_count > g::base_shader_data_end_register) {
+                // The relocated data would overlap with the constants of this shader
+                dbg(std::format("BTB shader uses {} constants, multiview data starts at {}", info.constant_register_count, g::base_shader_data_end_register));
+                g::failed_multiview_btb_shaders++;
+            } else {
+                uint32_t constant_table = 0;
+                if (cls == ShaderClass::BTB) {
+                    // Make room for the extra data
+                    g::d3d_vr->SetShaderConstantCount(multiview_shader, multiview_constant_count(info));
+                    constant_table = static_cast<uint32_t>(g::btb_constant_tables.size());
+                    g::btb_constant_tables.push_back({});
+                    g::btb_multiview_twins.emplace(hash, MultiviewTwin { bytecode, multiview_shader, constant_table });
+                    if (rbr::is_loading_btb_stage()) {
+                        prepatch_btb_shader(multiview_shader);
+                    }
+                }
+                g::shaders.insert(*ppShader, { multiview_shader, cls, false, info.constant_register_count, info.constant_usage_known, constant_table });
+                g::shaders.insert(multiview_shader, { multiview_shader, cls, true, info.constant_register_count, info.constant_usage_known, constant_table });
+            }
         }
 
         i++;
         if (!g::cfg.experimental.disable_multiview && i == 40) {
             // Base game shaders are loaded, patch them for multiview and run the SPIR-V optimizer
 
-            // Maximum number of float constants that is discovered to be present in a shader.
-            // Base game shaders have maximum of 90-something constants and those could be calculated,
-            // but BTB stage shaders aren't loaded at startup, so we're making an educated guess here.
-            g::base_shader_data_end_register = 110;
+            // The extra data is placed after the highest constant register used by the base game shaders.
+            // BTB stage shaders aren't loaded at startup, so some headroom is reserved for them on top of the
+            // 90-something constants the base game shaders use.
+            constexpr uint32_t min_data_end_register = 110;
+            g::base_shader_data_end_register = min_data_end_register;
+            for (const auto s : g::base_game_shaders) {
+                if (const auto info = g::shaders.find(s); info && info->constant_usage_known) {
+                    g::base_shader_data_end_register = std::max(g::base_shader_data_end_register, info->constant_register_count);
+                }
+            }
 
             for (auto j = 0; j < i; ++j) {
                 const auto original_shader = g::base_game_shaders[j];
                 const auto multiview_shader = g::base_game_multiview_shaders[j];
 
-                if (!patch_spirv_shader_registers(multiview_shader)) {
+                if (multiview_shader == original_shader || !patch_spirv_shader_registers(multiview_shader)) {
                     // If the patching fails, use the original shader
                     // This will probably cause rendering glitches but should not crash the game
                     g::base_game_multiview_shaders[j] = original_shader;
+                    fall_back_to_original_shader(g::shaders, original_shader, multiview_shader);
                     g::failed_multiview_base_game_shaders++;
                 }
             }
@@ -280,24 +1098,12 @@ namespace dx {
     {
         const auto ret = g::hooks::get_vertex_shader.call(This, pShader);
         if (multiview_rendering_enabled()) {
-            auto shader_it = std::find(g::base_game_shaders.cbegin(), g::base_game_shaders.cend(), *pShader);
-            if (shader_it != g::base_game_shaders.cend()) {
-                const auto index = std::distance(g::base_game_shaders.cbegin(), shader_it);
-                auto shader = g::base_game_multiview_shaders[index];
-                shader->AddRef();
-                (*pShader)->Release();
-                *pShader = shader;
-                return ret;
-            }
-
-            shader_it = std::find(g::original_btb_shaders.cbegin(), g::original_btb_shaders.cend(), *pShader);
-            if (shader_it != g::original_btb_shaders.cend()) {
-                const auto index = std::distance(g::original_btb_shaders.cbegin(), shader_it);
-                auto shader = g::multiview_btb_shaders[index];
+            const auto info = g::shaders.find(*pShader);
+            if (info && !info->is_multiview && info->multiview != *pShader) {
+                auto shader = info->multiview;
                 shader->AddRef();
                 (*pShader)->Release();
                 *pShader = shader;
-                return ret;
             }
         }
         return ret;
@@ -305,39 +1111,98 @@ namespace dx {
 
     HRESULT __stdcall SetVertexShader(IDirect3DDevice9* This, IDirect3DVertexShader9* pShader)
     {
+        stereo_replay::record(stereo_replay::Op::SetVertexShader, pShader);
+
         IDirect3DVertexShader9* shader = pShader;
         if (multiview_rendering_enabled()) {
-            auto shader_it = std::find(g::base_game_shaders.cbegin(), g::base_game_shaders.cend(), pShader);
-            if (shader_it != g::base_game_shaders.cend()) {
-                const auto index = std::distance(g::base_game_shaders.cbegin(), shader_it);
-                shader = g::base_game_multiview_shaders[index];
-            } else {
-                shader_it = std::find(g::original_btb_shaders.cbegin(), g::original_btb_shaders.cend(), pShader);
-                if (shader_it != g::original_btb_shaders.cend()) {
-                    const auto index = std::distance(g::original_btb_shaders.cbegin(), shader_it);
-                    shader = g::multiview_btb_shaders[index];
-                }
+            if (const auto info = g::shaders.find(pShader); info) {
+                shader = info->multiview;
             }
         }
 
         const auto ret = g::hooks::set_vertex_shader.call(This, shader);
+        if (SUCCEEDED(ret) && !shadow::recording_state_block) {
+            shadow::vertex_shader = shader;
+        }
 
         // If the shader was a null pointer while SetVertexShaderConstantF
-        // we have been collecting the data to g::deferred_shader_constants
+        // we have been collecting the data to constants::deferred
         // As we now have the shader present, apply the constants so we run
         // our shader patching and data relocation correctly.
-        if (pShader && !g::deferred_shader_constants.empty()) {
-            for (const auto& it : g::deferred_shader_constants) {
-                // We can just call our patched SetVertexShaderConstantF function
-                // It will handle patching the (BTB) shader etc. correctly
-                SetVertexShaderConstantF(This, it.first, it.second.data(), 4);
+        if (pShader && constants::deferred_registers.any()) {
+            // The constants were recorded when they were set
+            stereo_replay::suppress = true;
+            for (size_t i = 0; i < constants::deferred.size(); ++i) {
+                if (constants::deferred_registers[i]) {
+                    // We can just call our patched SetVertexShaderConstantF function
+                    // It will handle patching the (BTB) shader etc. correctly
+                    SetVertexShaderConstantF(This, i, constants::deferred[i].data(), 4);
+                }
             }
-            g::deferred_shader_constants.clear();
+            constants::deferred_registers.reset();
+            stereo_replay::suppress = false;
         }
 
         return ret;
     }
 
+    // Read the shadowed state from the device
+    static void sync_shadow_state(bool include_render_targets)
+    {
+        // Call the original GetVertexShader, the hook would return the multiview shader instead of the bound one
+        IDirect3DVertexShader9* shader = nullptr;
+        if (g::hooks::get_vertex_shader.call(g::d3d_dev, &shader) == D3D_OK && shader) {
+            shader->Release();
+        }
+        shadow::vertex_shader = shader;
+
+        for (DWORD i = 0; i < shadow::textures.size(); ++i) {
+            IDirect3DBaseTexture9* texture = nullptr;
+            if (g::d3d_dev->GetTexture(i, &texture) == D3D_OK && texture) {
+                texture->Release();
+            }
+            shadow::textures[i] = texture;
+        }
+
+        if (include_render_targets) {
+            IDirect3DSurface9* surface = nullptr;
+            if (g::d3d_dev->GetRenderTarget(0, &surface) == D3D_OK && surface) {
+                surface->Release();
+            }
+            shadow::render_target = surface;
+
+            surface = nullptr;
+            if (g::d3d_dev->GetDepthStencilSurface(&surface) == D3D_OK && surface) {
+                surface->Release();
+            }
+            shadow::depth_stencil_surface = surface;
+        }
+    }
+
+    // Compare the shadowed state against the device, and fix it if it has gone out of sync
+    static void verify_shadow_state()
+    {
+        const auto vertex_shader = shadow::vertex_shader;
+        const auto textures = shadow::textures;
+        const auto render_target = shadow::render_target;
+        const auto depth_stencil_surface = shadow::depth_stencil_surface;
+
+        sync_shadow_state(true);
+
+        const auto check = [](const char* name, const void* shadowed, const void* actual) {
+            if (shadowed != actual) {
+                dbg(std::format("Shadow state mismatch: {} {} != {}", name, shadowed, actual));
+                g::shadow_state_mismatches++;
+            }
+        };
+        check("vertex shader", vertex_shader, shadow::vertex_shader);
+        for (size_t i = 0; i < textures.size(); ++i) {
+            check("texture", textures[i], shadow::textures[i]);
+        }
+        check("render target", render_target, shadow::render_target);
+        check("depth stencil surface", depth_stencil_surface, shadow::depth_stencil_surface);
+    }
+
     static void draw_debug_info(uint64_t cpu_frametime_us)
     {
         g::game->SetColor(1, 0, 1, 1.0);
@@ -393,10 +1258,19 @@ namespace dx {
             } else {
                 g::game->WriteText(0, 18 * ++i, std::format("CPU: render time: {:.2f}ms", cpuTime).c_str());
                 g::game->WriteText(0, 18 * ++i, std::format("GPU: render time: {:.2f}ms", gpu_total).c_str());
+                g::game->WriteText(0, 18 * ++i,
+                    std::format("Frame wait: {:.2f}ms, pose age: {:.2f}ms{}",
+                        t.frame_wait,
+                        t.pose_age,
+                        g::cfg.experimental.pipelined_frame_loop ? " (pipelined)" : "")
+                        .c_str());
+                g::game->WriteText(0, 18 * ++i, std::format("Fence wait: {:.2f}ms ({} shared textures)", t.fence_wait, g::cfg.experimental.shared_texture_count).c_str());
             }
 
             g::game->WriteText(0, 18 * ++i, std::format("Mods: {} {}", rbr_rx::is_loaded() ? "RBRRX" : "", rbrhud::is_loaded() ? "RBRHUD" : "").c_str());
             g::game->WriteText(0, 18 * ++i, std::format("Render context: {}", g::vr->get_current_render_context_name()).c_str());
+            const auto pool = render_target_pool_stats();
+            g::game->WriteText(0, 18 * ++i, std::format("Render targets: {} MB pooled, {} MB unique, {} MB saved", pool.pooled_bytes / (1024 * 1024), pool.unique_bytes / (1024 * 1024), pool.saved_bytes / (1024 * 1024)).c_str());
             const auto& [lw, lh] = g::vr->get_render_resolution(LeftEye);
             const auto& [rw, rh] = g::vr->get_render_resolution(RightEye);
             g::game->WriteText(0, 18 * ++i, std::format("Render resolution: {}x{} (left), {}x{} (right)", lw, lh, rw, rh).c_str());
@@ -422,7 +1296,66 @@ namespace dx {
                     g::game->WriteText(0, 18 * ++i, std::format("  Failed BTB shaders: {}", g::failed_multiview_btb_shaders).c_str());
                 if (g::failed_multiview_btb_shader_optimizations > 0)
                     g::game->WriteText(0, 18 * ++i, std::format("  Failed BTB shader optimizations: {}", g::failed_multiview_btb_shader_optimizations).c_str());
+                if (g::btb_shader_optimizations_queued > 0) {
+                    g::game->WriteText(0, 18 * ++i,
+                        std::format("  BTB shader optimizations: {} queued, {} in flight, {} applied",
+                            g::btb_shader_optimizations_queued,
+                            g::spirv_worker ? g::spirv_worker->in_flight() : 0,
+                            g::btb_shader_optimizations_applied)
+                            .c_str());
+                }
+                if (stage_load::applied + stage_load::cached > 0) {
+                    g::game->WriteText(0, 18 * ++i,
+                        std::format("  BTB shaders patched during load: {} ({} cached), {:.1f}ms",
+                            stage_load::applied + stage_load::cached,
+                            stage_load::cached,
+                            stage_load::patch_time.count() / 1000.0)
+                            .c_str());
+                }
+                if (g::shared_multiview_shaders > 0)
+                    g::game->WriteText(0, 18 * ++i, std::format("  Shared multiview shaders: {}", g::shared_multiview_shaders).c_str());
+                if (g::btb_constant_classifications > 0)
+                    g::game->WriteText(0, 18 * ++i, std::format("  BTB constant classifications: {}", g::btb_constant_classifications).c_str());
+                if (rbr::is_on_btb_stage()) {
+                    g::game->WriteText(0, 18 * ++i,
+                        std::format("  BTB matrix products: {} computed, {} consumed",
+                            g::btb_comparison_products_computed_last_frame,
+                            g::btb_comparison_products_consumed_last_frame)
+                            .c_str());
+                }
+                const auto& cache = shader_cache::stats();
+                g::game->WriteText(0, 18 * ++i, std::format("  Shader cache: {} hits, {} misses, {} stored", cache.hits.load(), cache.misses.load(), cache.stores.load()).c_str());
+            }
+            g::game->WriteText(0, 18 * ++i, std::format("Projection inverses: {} hits, {} misses", g::projection_inverse_hits, g::projection_inverse_misses).c_str());
+            g::game->WriteText(0, 18 * ++i, std::format("Skipped constant uploads: {}", constants::skipped_uploads_last_frame).c_str());
+            {
+                const auto& skipped = draw_classifier::skipped_last_frame;
+                g::game->WriteText(0, 18 * ++i,
+                    std::format("Skipped draws: {} shadow quad, {} windscreen, {} BTB shadow",
+                        skipped[static_cast<size_t>(DrawCategory::CockpitShadowQuad)],
+                        skipped[static_cast<size_t>(DrawCategory::WetWindscreen)],
+                        skipped[static_cast<size_t>(DrawCategory::BTBShadow)])
+                        .c_str());
+            }
+            if (g::cfg.experimental.filter_redundant_states) {
+                g::game->WriteText(0, 18 * ++i,
+                    std::format("State changes: {} forwarded, {} filtered",
+                        state_filter::forwarded_last_frame,
+                        state_filter::filtered_last_frame)
+                        .c_str());
+            }
+            if (g::cfg.experimental.stereo_replay) {
+                g::game->WriteText(0, 18 * ++i,
+                    std::format("Stereo replay: {} replayed, {} fallbacks, {} mismatches, {} commands, {} KB",
+                        stereo_replay::replayed,
+                        stereo_replay::fallbacks,
+                        stereo_replay::mismatches,
+                        stereo_replay::recorded_last_frame,
+                        stereo_replay::recorded_bytes_last_frame / 1024)
+                        .c_str());
             }
+            if (g::shadow_state_mismatches > 0)
+                g::game->WriteText(0, 18 * ++i, std::format("Shadow state mismatches: {}", g::shadow_state_mismatches).c_str());
             g::game->WriteText(0, 18 * ++i, std::format("Anisotropic filtering: {}x", g::cfg.anisotropy).c_str());
             g::game->WriteText(0, 18 * ++i, std::format("Current stage ID: {}", rbr::get_current_stage_id()).c_str());
         } else {
@@ -453,41 +1386,120 @@ namespace dx {
     {
         const auto& size = render_target_2d == GameMenu ? 1.0f : g::cfg.overlay_size;
         const auto& translation = render_target_2d == Overlay ? g::cfg.overlay_translation : (g::cfg.menu_scene ? glm::vec3 { 0.0f, -0.1f, 0.65f - g::cfg.menu_size } : glm::vec3 { 0.0f, -0.1f, 0.65f - g::cfg.menu_size });
-        const auto& horizon_lock = render_target_2d == Overlay ? std::make_optional(rbr::get_horizon_lock_matrix()) : std::nullopt;
+        const auto horizon_lock = render_target_2d == Overlay;
         const auto& texture = g::vr->get_texture(render_target_2d);
 
-        if (g::vr->prepare_vr_rendering(g::d3d_dev, LeftEye, clear)) {
-            render_menu_quad(g::d3d_dev, g::vr, texture, LeftEye, render_target_2d, size, translation, horizon_lock);
-            g::vr->finish_vr_rendering(g::d3d_dev, LeftEye);
-        } else {
-            dbg("Failed to render left eye overlay");
+        std::array<RenderTarget, 4> views;
+        size_t view_count = 0;
+        views[view_count++] = LeftEye;
+        if (g::vr->is_using_quad_view_rendering()) {
+            views[view_count++] = FocusLeft;
+        }
+        if (!multiview_rendering_enabled()) {
+            views[view_count++] = RightEye;
+            if (g::vr->is_using_quad_view_rendering()) {
+                views[view_count++] = FocusRight;
+            }
         }
 
-        if (g::vr->is_using_quad_view_rendering()) {
-            if (g::vr->prepare_vr_rendering(g::d3d_dev, FocusLeft, clear)) {
-                render_menu_quad(g::d3d_dev, g::vr, texture, FocusLeft, render_target_2d, size, translation, horizon_lock);
-                g::vr->finish_vr_rendering(g::d3d_dev, FocusLeft);
-            } else {
-                dbg("Failed to render left eye overlay");
+        render_menu_quads(g::d3d_dev, g::vr, texture, std::span(views.data(), view_count), render_target_2d, size, translation, horizon_lock, clear);
+    }
+
+    // Run the SPIR-V optimizer for the BTB shaders patched during the frame.
+    // Optimizing takes long enough to cause hitches, so unless the result is already
+    // in the shader cache, the optimization is done in a worker thread.
+    static void queue_btb_shader_optimizations()
+    {
+        for (const auto& [shader, registers] : g::patched_btb_shaders) {
+            // Optimized shaders are not patched for new registers anymore.
+            // Marking the shader already here keeps it from changing while the worker is optimizing it.
+            g::optimized_btb_shaders.insert(shader);
+
+            const auto hash = get_shader_hash(shader);
+
+            // Remember the registers, so the shader can be patched already during the stage load next time
+            if (shader_cache::lookup_registers(hash) != registers) {
+                shader_cache::store_registers(hash, registers);
             }
+
+            const auto recipe = btb_patch_recipe(registers, true);
+            if (const auto cached = patch_shader_from_cache(shader, hash, recipe); cached) {
+                if (!cached.value()) {
+                    g::failed_multiview_btb_shader_optimizations++;
+                }
+                continue;
+            }
+
+            get_spirv_worker()->submit({ shader, g::btb_shader_generation, hash, recipe, get_spirv(shader), optimize_spirv });
+            g::btb_shader_optimizations_queued++;
         }
+        g::patched_btb_shaders.clear();
+    }
 
-        if (!multiview_rendering_enabled()) {
-            if (g::vr->prepare_vr_rendering(g::d3d_dev, RightEye, clear)) {
-                render_menu_quad(g::d3d_dev, g::vr, texture, RightEye, render_target_2d, size, translation, horizon_lock);
-                g::vr->finish_vr_rendering(g::d3d_dev, RightEye);
+    static void apply_spirv_worker_result(const SpirvWorker::Result& result)
+    {
+        if (result.generation != g::btb_shader_generation) {
+            // The shader was released while the worker was optimizing it
+            return;
+        }
+
+        const auto prepatched = stage_load::pending.erase(result.shader) > 0;
+        if (result.ok) {
+            g::d3d_vr->PatchSPIRVToVertexShader(result.shader, result.spirv.data(), result.spirv.size());
+            if (prepatched) {
+                stage_load::applied++;
+                stage_load::patch_time += result.duration;
             } else {
-                dbg("Failed to render left eye overlay");
+                g::btb_shader_optimizations_applied++;
             }
-            if (g::vr->is_using_quad_view_rendering()) {
-                if (g::vr->prepare_vr_rendering(g::d3d_dev, FocusRight, clear)) {
-                    render_menu_quad(g::d3d_dev, g::vr, texture, FocusRight, render_target_2d, size, translation, horizon_lock);
-                    g::vr->finish_vr_rendering(g::d3d_dev, FocusRight);
-                } else {
-                    dbg("Failed to render left eye overlay");
-                }
+        } else if (prepatched) {
+            // Fall back to patching the shader on its first use
+            g::optimized_btb_shaders.erase(result.shader);
+            stage_load::failed++;
+        } else {
+            dbg("Shader optimization failed!");
+            g::failed_multiview_btb_shader_optimizations++;
+        }
+    }
+
+    // Apply optimized BTB shaders from the SPIR-V worker, limiting the time spent on it per frame
+    static void apply_btb_shader_optimizations()
+    {
+        constexpr auto frame_budget = std::chrono::microseconds(500);
+
+        if (!g::spirv_worker) {
+            return;
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        while (std::chrono::steady_clock::now() - start < frame_budget) {
+            auto result = g::spirv_worker->poll();
+            if (!result) {
+                break;
             }
+            apply_spirv_worker_result(result.value());
+        }
+    }
+
+    void finish_btb_stage_load()
+    {
+        if (!g::spirv_worker || stage_load::queued == 0) {
+            return;
+        }
+
+        // The stage is about to start, wait for the rest of the shaders patched during the load
+        const auto start = std::chrono::steady_clock::now();
+        while (auto result = g::spirv_worker->wait()) {
+            apply_spirv_worker_result(result.value());
         }
+        const auto waited = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+
+        dbg(std::format("BTB stage load: {} shaders patched in advance, {} from the shader cache, {} failed. {:.1f}ms of patching done during the load, waited {:.1f}ms for it at the end.",
+            stage_load::applied,
+            stage_load::cached,
+            stage_load::failed,
+            stage_load::patch_time.count() / 1000.0,
+            waited.count()));
     }
 
     HRESULT __stdcall Present(IDirect3DDevice9* This, const RECT* pSourceRect, const RECT* pDestRect, HWND hDestWindowOverride, const RGNDATA* pDirtyRegion)
@@ -535,14 +1547,19 @@ namespace dx {
         ret = g::hooks::present.call(g::d3d_dev, pSourceRect, pDestRect, hDestWindowOverride, pDirtyRegion);
         g::current_frames++;
 
-        for (auto& it : g::patched_btb_shaders) {
-            if (!optimize_spirv_shader(it.first)) {
-                dbg("Shader optimization failed!");
-                g::failed_multiview_btb_shader_optimizations++;
-            }
-            g::optimized_btb_shaders.insert(it.first);
+        if (g::cfg.debug) {
+            verify_shadow_state();
         }
-        g::patched_btb_shaders.clear();
+        g::btb_comparison_products_computed_last_frame = std::exchange(g::btb_comparison_products_computed, 0);
+        g::btb_comparison_products_consumed_last_frame = std::exchange(g::btb_comparison_products_consumed, 0);
+        state_filter::forwarded_last_frame = std::exchange(state_filter::forwarded, 0);
+        state_filter::filtered_last_frame = std::exchange(state_filter::filtered, 0);
+        constants::skipped_uploads_last_frame = std::exchange(constants::skipped_uploads, 0);
+        draw_classifier::skipped_last_frame = std::exchange(draw_classifier::skipped, {});
+        draw_classifier::frame++;
+
+        queue_btb_shader_optimizations();
+        apply_btb_shader_optimizations();
 
         if (g::vr && !g::vr_error) {
             g::vr->submit_frames_to_hmd(g::d3d_dev);
@@ -552,114 +1569,193 @@ namespace dx {
             }
         }
 
-        g::original_render_target->Release();
-        g::original_depth_stencil_target->Release();
+        if (std::chrono::steady_clock::now() - g::second_start > std::chrono::seconds(1)) {
+            g::second_start = std::chrono::steady_clock::now();
+            g::fps = g::current_frames - 1;
+            g::target_fps = std::max(g::fps, g::target_fps);
+            g::current_frames = 0;
+        }
+
+        g::vr_error = false;
+        return ret;
+    }
+
+    static void invalidate_btb_comparison_matrices(RenderTarget tgt)
+    {
+        fixedfunction::dirty_comparison_matrices |= 1 << tgt;
+    }
+
+    static void invalidate_btb_comparison_matrices()
+    {
+        fixedfunction::dirty_comparison_matrices = 0xF;
+    }
+
+    // The products are only needed if a BTB shader constant is set, so they are computed on demand
+    static void update_btb_comparison_matrices(RenderTarget tgt)
+    {
+        if (!(fixedfunction::dirty_comparison_matrices & (1 << tgt))) {
+            return;
+        }
+
+        // The shader constants are compared byte by byte against these, see MatrixKernels.hpp
+        const auto world = &fixedfunction::current_world_matrix._11;
+        const auto proj = &fixedfunction::current_projection_matrix[tgt]._11;
+        const auto view = &fixedfunction::current_view_matrix[tgt]._11;
+
+        D3DMATRIX viewproj;
+        matrix::multiply(view, proj, &viewproj._11);
+        matrix::multiply_transpose(proj, view, &fixedfunction::current_projview_matrix[tgt]._11);
+        matrix::multiply_transpose(view, proj, &fixedfunction::current_viewproj_matrix[tgt]._11);
+
+        // World * view and world * view * projection share the world matrix
+        const float* rhs[] = { view, &viewproj._11 };
+        float* out[] = { &fixedfunction::current_worldview_matrix[tgt]._11, &fixedfunction::current_worldviewproj_matrix[tgt]._11 };
+        matrix::multiply_transpose_n(world, rhs, out, 2);
+
+        fixedfunction::dirty_comparison_matrices &= ~(1 << tgt);
+        g::btb_comparison_products_computed += 4;
+    }
+
+    static const D3DMATRIX* btb_comparison_matrix(BTBConstant c, RenderTarget tgt)
+    {
+        switch (c) {
+            case BTBConstant::World: return &fixedfunction::current_world_matrix;
+            case BTBConstant::Projection: return &fixedfunction::current_projection_matrix[tgt];
+            case BTBConstant::View: return &fixedfunction::current_view_matrix[tgt];
+            default: break;
+        }
+
+        update_btb_comparison_matrices(tgt);
+        switch (c) {
+            case BTBConstant::ProjView: return &fixedfunction::current_projview_matrix[tgt];
+            case BTBConstant::ViewProj: return &fixedfunction::current_viewproj_matrix[tgt];
+            case BTBConstant::WorldView: return &fixedfunction::current_worldview_matrix[tgt];
+            case BTBConstant::WorldViewProj: return &fixedfunction::current_worldviewproj_matrix[tgt];
+            default: return nullptr;
+        }
+    }
+
+    static bool is_btb_constant(BTBConstant c, RenderTarget left, const float* pConstantData)
+    {
+        const auto m = btb_comparison_matrix(c, left);
+        return m && memcmp(pConstantData, m, sizeof(D3DMATRIX)) == 0;
+    }
 
-        if (std::chrono::steady_clock::now() - g::second_start > std::chrono::seconds(1)) {
-            g::second_start = std::chrono::steady_clock::now();
-            g::fps = g::current_frames - 1;
-            g::target_fps = std::max(g::fps, g::target_fps);
-            g::current_frames = 0;
+    // Uploads the left view data to `reg` and the right view data to `reg + 4`.
+    // The two ranges are contiguous for matrices, in which case they're staged and uploaded with one call.
+    static HRESULT set_stereo_vertex_shader_constant(UINT reg, const float* left, const float* right, UINT Vector4fCount)
+    {
+        if (Vector4fCount == 4) [[likely]] {
+            std::array<float, 32> staging;
+            std::copy_n(left, 16, staging.begin());
+            std::copy_n(right, 16, staging.begin() + 16);
+            return constants::upload(reg, staging.data(), 8);
         }
 
-        g::vr_error = false;
+        auto ret = constants::upload(reg, left, Vector4fCount);
+        ret |= constants::upload(reg + 4, right, Vector4fCount);
         return ret;
     }
 
-    static bool set_btb_vertex_shader_constant(IDirect3DDevice9* This, UINT StartRegister, uint32_t start_index, const D3DMATRIX* matrices, const float* pConstantData, UINT Vector4fCount)
+    static void set_btb_vertex_shader_constant(UINT StartRegister, uint32_t start_index, BTBConstant c, RenderTarget left, const float* pConstantData, UINT Vector4fCount)
     {
-        const auto left = g::vr_render_target.value_or(LeftEye);
         const auto right = render_target_counterpart(left);
-        if (memcmp(pConstantData, &matrices[left], sizeof(D3DMATRIX)) == 0) {
-            g::hooks::set_vertex_shader_constant_f.call(g::d3d_dev, StartRegister + start_index, reinterpret_cast<const float*>(matrices[left].m), Vector4fCount);
-            g::hooks::set_vertex_shader_constant_f.call(g::d3d_dev, StartRegister + start_index + 4, reinterpret_cast<const float*>(matrices[right].m), Vector4fCount);
-            if (Vector4fCount > 4) {
-                // There's this one weird shader that has the camera position as fifth Vector4f element after the matrix.
-                // Copy the original data in the original location as the fifth element can be same for each view as it's moving the skybox along the camera.
-                g::hooks::set_vertex_shader_constant_f.call(g::d3d_dev, StartRegister, pConstantData, Vector4fCount);
-            }
-            return true;
+        set_stereo_vertex_shader_constant(
+            StartRegister + start_index,
+            reinterpret_cast<const float*>(btb_comparison_matrix(c, left)->m),
+            reinterpret_cast<const float*>(btb_comparison_matrix(c, right)->m),
+            Vector4fCount);
+        if (c != BTBConstant::Projection && c != BTBConstant::View) {
+            g::btb_comparison_products_consumed += 2;
+        }
+        if (Vector4fCount > 4) {
+            // There's this one weird shader that has the camera position as fifth Vector4f element after the matrix.
+            // Copy the original data in the original location as the fifth element can be same for each view as it's moving the skybox along the camera.
+            constants::upload(StartRegister, pConstantData, Vector4fCount);
         }
-        return false;
     }
 
-    HRESULT __stdcall SetVertexShaderConstantF(IDirect3DDevice9* This, UINT StartRegister, const float* pConstantData, UINT Vector4fCount)
+    static void patch_btb_shader_register(IDirect3DVertexShader9* shader, UINT StartRegister)
     {
-        IDirect3DVertexShader9* shader;
-        if (auto ret = g::d3d_dev->GetVertexShader(&shader); ret != D3D_OK) {
-            dbg("Could not get vertex shader");
-            return ret;
+        if (g::optimized_btb_shaders.contains(shader)) {
+            return;
+        }
+
+        auto& regs = g::patched_btb_shaders[shader];
+        if (std::find(regs.cbegin(), regs.cend(), StartRegister) != regs.cend()) {
+            return;
+        }
+
+        // Either the first patch for the shader, or another variable at `StartRegister` that needs the shader to be patched again
+        regs.push_back(StartRegister);
+        const auto patch = [StartRegister](std::vector<uint32_t>& spirv) {
+            return patch_spirv(spirv, StartRegister, g::base_shader_data_end_register, false);
+        };
+        if (!patch_shader_cached(shader, btb_patch_recipe(regs, false), patch)) {
+            dbg("Shader patch failed!");
+            g::failed_multiview_btb_shaders++;
         }
+    }
+
+    HRESULT __stdcall SetVertexShaderConstantF(IDirect3DDevice9* This, UINT StartRegister, const float* pConstantData, UINT Vector4fCount)
+    {
+        stereo_replay::record(stereo_replay::Op::SetVertexShaderConstantF, StartRegister, stereo_replay::Array<float> { pConstantData, Vector4fCount * 4 });
 
+        const auto shader = shadow::vertex_shader;
+        const auto info = g::shaders.find(shader);
         auto is_base_shader = true;
         if (rbr::is_on_btb_stage()) {
-            const auto& shaders = multiview_rendering_enabled() ? g::base_game_multiview_shaders : g::base_game_shaders;
-            is_base_shader = std::find(shaders.cbegin(), shaders.cend(), shader) != shaders.end();
+            is_base_shader = info && info->cls != ShaderClass::BTB;
         }
 
         auto reg = multiview_rendering_enabled() ? StartRegister + g::base_shader_data_end_register : StartRegister;
-        if (!shader && Vector4fCount == 4) {
+        if (!shader && Vector4fCount == 4 && StartRegister < constants::deferred.size()) {
             // DirectX allows setting shader constants even though the shader isn't bound (yet)
             // Therefore we need to defer setting the constants for such shaders in order to be able to
             // correctly patch them for multiview and supply the data accordingly.
-            std::array<float, 16> m;
-            std::copy_n(pConstantData, 16, m.begin());
-            g::deferred_shader_constants.insert_or_assign(StartRegister, m);
+            std::copy_n(pConstantData, 16, constants::deferred[StartRegister].begin());
+            constants::deferred_registers[StartRegister] = true;
         } else if (shader && is_base_shader && Vector4fCount == 4) {
-            shader->Release();
-
             if (g::vr_render_target) {
                 const auto target = g::vr_render_target.value();
                 if (StartRegister == 0) {
                     const auto orig = glm::transpose(m4_from_shader_constant_ptr(pConstantData));
-                    const auto& projection = g::vr->get_projection(target);
-                    const auto& eyepos = g::vr->get_eye_pos(target);
-                    const auto& pose = g::vr->get_pose(target);
+                    const auto& frame = g::vr->get_frame_matrices();
 
                     // MVP matrix
                     // MV = P^-1 * MVP
                     // MVP[VRRenderTarget] = P[VRRenderTarget] * MV
+                    // Both views are calculated from the same MV in one pass with multiview.
                     const auto mv = shader::current_projection_matrix_inverse * orig;
-                    const auto mvp = glm::transpose(projection * eyepos * pose * g::flip_z_matrix * rbr::get_horizon_lock_matrix() * mv);
-                    auto ret = g::hooks::set_vertex_shader_constant_f.call(g::d3d_dev, reg, glm::value_ptr(mvp), Vector4fCount);
-
-                    if (multiview_rendering_enabled()) {
-                        const auto right = render_target_counterpart(target);
-                        const auto& projection = g::vr->get_projection(right);
-                        const auto& eyepos = g::vr->get_eye_pos(right);
-                        const auto& pose = g::vr->get_pose(right);
-                        const auto mvp = glm::transpose(projection * eyepos * pose * g::flip_z_matrix * rbr::get_horizon_lock_matrix() * mv);
-                        ret |= g::hooks::set_vertex_shader_constant_f.call(g::d3d_dev, reg + 4, glm::value_ptr(mvp), Vector4fCount);
+                    const auto views = multiview_rendering_enabled() ? 2 : 1;
+                    const auto right = views > 1 ? render_target_counterpart(target) : target;
+                    M4 mvp[2];
+                    const float* vp_ptrs[2] = { glm::value_ptr(frame.view_projection[target]), glm::value_ptr(frame.view_projection[right]) };
+                    float* mvp_ptrs[2] = { glm::value_ptr(mvp[0]), glm::value_ptr(mvp[1]) };
+                    matrix::multiply_transpose_n(glm::value_ptr(mv), vp_ptrs, mvp_ptrs, views);
+
+                    if (views > 1) {
+                        return set_stereo_vertex_shader_constant(reg, glm::value_ptr(mvp[0]), glm::value_ptr(mvp[1]), Vector4fCount);
                     }
-                    return ret;
+                    return constants::upload(reg, glm::value_ptr(mvp[0]), Vector4fCount);
                 } else if (StartRegister == 20) {
                     // Sky/fog
                     // It seems this parameter contains the orientation of the car and the
                     // skybox and fog is rendered correctly only in the direction where the car
                     // points at. By rotating this with the HMD's rotation, the skybox and possible
                     // fog is rendered correctly.
+                    // The rotation is calculated once per frame along with the other pose dependent matrices
                     const auto orig = glm::transpose(m4_from_shader_constant_ptr(pConstantData));
-                    glm::vec4 perspective;
-                    glm::vec3 scale, translation, skew;
-                    glm::quat orientation;
-
-                    // Always use left eye for the pose, as some effects (like the "darkness" effect in Mitterbach Tarmac night version)
-                    // may render differently in each eye, especially if the object is far away, which makes it look awful.
-                    // For the fog, the orientation is close enough for both eyes when always rendered with the same eye.
-                    glm::decompose(g::vr->get_pose(LeftEye), scale, orientation, translation, skew, perspective);
-                    const auto m = glm::transpose(glm::mat4_cast(glm::conjugate(orientation)) * orig);
+                    const auto m = glm::transpose(g::vr->get_frame_matrices().sky_rotation * orig);
 
-                    auto ret = g::hooks::set_vertex_shader_constant_f.call(g::d3d_dev, reg, glm::value_ptr(m), Vector4fCount);
                     if (multiview_rendering_enabled()) {
-                        ret |= g::hooks::set_vertex_shader_constant_f.call(g::d3d_dev, reg + 4, glm::value_ptr(m), Vector4fCount);
+                        return set_stereo_vertex_shader_constant(reg, glm::value_ptr(m), glm::value_ptr(m), Vector4fCount);
                     }
-
-                    return ret;
+                    return constants::upload(reg, glm::value_ptr(m), Vector4fCount);
                 }
             } else if (multiview_rendering_enabled() && (StartRegister == 0 || StartRegister == 20)) {
                 // Place the data in the multiview locations also when rendering the main menu (g::vr_render_target is not set)
-                g::hooks::set_vertex_shader_constant_f.call(g::d3d_dev, reg, pConstantData, Vector4fCount);
-                return g::hooks::set_vertex_shader_constant_f.call(g::d3d_dev, reg + 4, pConstantData, Vector4fCount);
+                return set_stereo_vertex_shader_constant(reg, pConstantData, pConstantData, Vector4fCount);
             }
         } else if (multiview_rendering_enabled() && shader && !is_base_shader && (Vector4fCount == 4 || Vector4fCount == 5)) {
             // Multiview BTB shader data passing
@@ -667,124 +1763,110 @@ namespace dx {
             // However, with multiview we need again to first patch the shaders that were loaded after the game was
             // loaded, and afterwards we need to supply the data into the correct location.
 
-            if (memcmp(pConstantData, &fixedfunction::current_world_matrix, sizeof(D3DMATRIX)) == 0) {
-                // World matrix is the same for both perspectives, no need to do anything
-                return g::hooks::set_vertex_shader_constant_f.call(g::d3d_dev, StartRegister, pConstantData, Vector4fCount);
-            }
-
-            std::vector<uint32_t> new_registers;
-            std::vector<uint32_t>& regs = new_registers;
-            auto patched_shader = g::patched_btb_shaders.find(shader);
-            if (patched_shader != g::patched_btb_shaders.end()) {
-                regs = patched_shader->second;
+            const auto reads_register = info && info->is_multiview && (!info->constant_usage_known || StartRegister < info->constant_register_count);
+            if (!reads_register) {
+                // Either the shader couldn't be copied for multiview, or it doesn't use this data at all
+                return constants::upload(StartRegister, pConstantData, Vector4fCount);
             }
 
-            const auto this_register_patched = std::find(regs.cbegin(), regs.cend(), StartRegister) != regs.cend();
-
-            if (!g::optimized_btb_shaders.contains(shader)) {
-                if (regs.empty()) {
-                    g::d3d_vr->SetShaderConstantCount(shader, g::base_shader_data_end_register * 2);
-                    if (!patch_spirv_shader(shader, StartRegister, g::base_shader_data_end_register, false)) {
-                        dbg("Shader patch failed!");
-                        g::failed_multiview_btb_shaders++;
-                    }
-                    regs.push_back(StartRegister);
-                    g::patched_btb_shaders[shader] = regs;
-                } else if (!this_register_patched) {
-                    // This is another variable at `StartRegister`, patch the shader again
-                    if (!patch_spirv_shader(shader, StartRegister, g::base_shader_data_end_register, false)) {
-                        dbg("Shader patch failed!");
-                        g::failed_multiview_btb_shaders++;
-                    }
-                    regs.push_back(StartRegister);
-                    g::patched_btb_shaders[shader] = regs;
+            // The matrix passed at `StartRegister` is learned on the first upload
+            const auto left = g::vr_render_target.value_or(LeftEye);
+            auto& table = g::btb_constant_tables[info->constant_table];
+            BTBConstantEntry unlearned {};
+            auto& entry = StartRegister < table.size() ? table[StartRegister] : unlearned;
+            const auto learned = entry.constant;
+
+            bool classified;
+            const auto c = learn_btb_constant(entry, pConstantData, Vector4fCount, [&](BTBConstant candidate) { return is_btb_constant(candidate, left, pConstantData); }, classified);
+            if (classified) {
+                if (c != learned) {
+                    g::btb_constant_classifications++;
+                }
+                if (c != BTBConstant::World) {
+                    patch_btb_shader_register(shader, StartRegister);
                 }
             }
 
-            shader->Release();
-
-            // We don't know which one of these this matrix is, so we test it against known candidates.
-            // These are the different ones passed to shaders, gathered from the BTB stage list of RSF.
-            // Some custom stages might have other shaders that pass the data in a different format.
-            // Those won't work without handling them here, but such is life.
-            if (set_btb_vertex_shader_constant(This, StartRegister, g::base_shader_data_end_register, fixedfunction::current_projection_matrix, pConstantData, Vector4fCount))
-                return D3D_OK;
-            if (set_btb_vertex_shader_constant(This, StartRegister, g::base_shader_data_end_register, fixedfunction::current_view_matrix, pConstantData, Vector4fCount))
-                return D3D_OK;
-            if (set_btb_vertex_shader_constant(This, StartRegister, g::base_shader_data_end_register, fixedfunction::current_projview_matrix, pConstantData, Vector4fCount))
-                return D3D_OK;
-            if (set_btb_vertex_shader_constant(This, StartRegister, g::base_shader_data_end_register, fixedfunction::current_viewproj_matrix, pConstantData, Vector4fCount))
-                return D3D_OK;
-            if (set_btb_vertex_shader_constant(This, StartRegister, g::base_shader_data_end_register, fixedfunction::current_worldview_matrix, pConstantData, Vector4fCount))
-                return D3D_OK;
-            if (set_btb_vertex_shader_constant(This, StartRegister, g::base_shader_data_end_register, fixedfunction::current_worldviewproj_matrix, pConstantData, Vector4fCount))
+            if (c == BTBConstant::World) {
+                // World matrix is the same for both perspectives, no need to do anything
+                return constants::upload(StartRegister, pConstantData, Vector4fCount);
+            } else if (c == BTBConstant::Other) {
+                set_stereo_vertex_shader_constant(reg, pConstantData, pConstantData, Vector4fCount);
+            } else {
+                set_btb_vertex_shader_constant(StartRegister, g::base_shader_data_end_register, c, left, pConstantData, Vector4fCount);
                 return D3D_OK;
-
-            g::hooks::set_vertex_shader_constant_f.call(g::d3d_dev, reg, pConstantData, Vector4fCount);
-            g::hooks::set_vertex_shader_constant_f.call(g::d3d_dev, reg + 4, pConstantData, Vector4fCount);
+            }
         }
 
-        return g::hooks::set_vertex_shader_constant_f.call(g::d3d_dev, StartRegister, pConstantData, Vector4fCount);
+        return constants::upload(StartRegister, pConstantData, Vector4fCount);
     }
 
-    static void update_btb_comparison_matrices(RenderTarget left, RenderTarget right)
+    static const M4& projection_inverse(const D3DMATRIX& projection)
     {
-        const auto world = m4_from_d3d(fixedfunction::current_world_matrix);
-        const auto update_matrices = [&world](RenderTarget tgt) {
-            const auto proj = m4_from_d3d(fixedfunction::current_projection_matrix[tgt]);
-            const auto view = m4_from_d3d(fixedfunction::current_view_matrix[tgt]);
-
-            fixedfunction::current_projview_matrix[tgt] = d3d_from_m4(glm::transpose(view * proj));
-            fixedfunction::current_viewproj_matrix[tgt] = d3d_from_m4(glm::transpose(proj * view));
-            fixedfunction::current_worldview_matrix[tgt] = d3d_from_m4(glm::transpose(view * world));
-            fixedfunction::current_worldviewproj_matrix[tgt] = d3d_from_m4(glm::transpose(proj * view * world));
-        };
+        for (const auto& entry : shader::projection_inverses) {
+            if (entry.valid && memcmp(&entry.projection, &projection, sizeof(D3DMATRIX)) == 0) {
+                g::projection_inverse_hits++;
+                return entry.inverse;
+            }
+        }
 
-        update_matrices(left);
-        update_matrices(right);
+        g::projection_inverse_misses++;
+        auto& entry = shader::projection_inverses[shader::next_projection_inverse++ % shader::projection_inverses.size()];
+        entry.projection = projection;
+        if (const auto inverse = perspective_inverse(projection); inverse) {
+            entry.inverse = inverse.value();
+        } else {
+            entry.inverse = glm::inverse(m4_from_d3d(projection));
+        }
+        entry.valid = true;
+        return entry.inverse;
     }
 
     HRESULT __stdcall SetTransform(IDirect3DDevice9* This, D3DTRANSFORMSTATETYPE State, const D3DMATRIX* pMatrix)
     {
+        if (pMatrix) {
+            stereo_replay::record(stereo_replay::Op::SetTransform, State, *pMatrix);
+        }
+
         if (g::vr_render_target) {
             const auto target = g::vr_render_target.value();
 
             if (State == D3DTS_PROJECTION) {
                 // Store the inverse of the matrix passed to the function in order to cancel it out later on
                 shader::current_projection_matrix = m4_from_d3d(*pMatrix);
-                shader::current_projection_matrix_inverse = glm::inverse(shader::current_projection_matrix);
+                shader::current_projection_matrix_inverse = projection_inverse(*pMatrix);
 
                 // Change projection matrix to current VR render target matrix
                 fixedfunction::current_projection_matrix[target] = d3d_from_m4(g::vr->get_projection(target));
+                invalidate_btb_comparison_matrices(target);
                 auto ret = g::hooks::set_transform.call(g::d3d_dev, D3DTS_PROJECTION_LEFT, &fixedfunction::current_projection_matrix[target]);
 
                 if (multiview_rendering_enabled()) {
                     const auto multiview_target = render_target_counterpart(target);
                     fixedfunction::current_projection_matrix[multiview_target] = d3d_from_m4(g::vr->get_projection(multiview_target));
-                    update_btb_comparison_matrices(target, multiview_target);
+                    invalidate_btb_comparison_matrices(multiview_target);
                     ret |= g::hooks::set_transform.call(g::d3d_dev, D3DTS_PROJECTION_RIGHT, &fixedfunction::current_projection_matrix[multiview_target]);
                 }
 
                 return ret;
             } else if (State == D3DTS_VIEW) {
-                fixedfunction::current_view_matrix[target] = d3d_from_m4(
-                    g::vr->get_eye_pos(target) * g::vr->get_pose(target) * g::flip_z_matrix * rbr::get_horizon_lock_matrix() * m4_from_d3d(*pMatrix));
+                const auto& frame = g::vr->get_frame_matrices();
+                fixedfunction::current_view_matrix[target] = d3d_from_m4(frame.view[target] * m4_from_d3d(*pMatrix));
+                invalidate_btb_comparison_matrices(target);
                 auto ret = g::hooks::set_transform.call(g::d3d_dev, D3DTS_VIEW_LEFT, &fixedfunction::current_view_matrix[target]);
 
                 if (multiview_rendering_enabled()) {
                     const auto multiview_target = render_target_counterpart(target);
-                    fixedfunction::current_view_matrix[multiview_target] = d3d_from_m4(
-                        g::vr->get_eye_pos(multiview_target) * g::vr->get_pose(multiview_target) * g::flip_z_matrix * rbr::get_horizon_lock_matrix() * m4_from_d3d(*pMatrix));
-                    update_btb_comparison_matrices(target, multiview_target);
+                    fixedfunction::current_view_matrix[multiview_target] = d3d_from_m4(frame.view[multiview_target] * m4_from_d3d(*pMatrix));
+                    invalidate_btb_comparison_matrices(multiview_target);
                     ret |= g::hooks::set_transform.call(g::d3d_dev, D3DTS_VIEW_RIGHT, &fixedfunction::current_view_matrix[multiview_target]);
                 }
 
                 return ret;
             } else if (multiview_rendering_enabled() && State == D3DTS_WORLD) {
                 // These matrices are needed for BTB shader constants in multiview case
-                const auto multiview_target = render_target_counterpart(target);
                 fixedfunction::current_world_matrix = *pMatrix;
-                update_btb_comparison_matrices(target, multiview_target);
+                invalidate_btb_comparison_matrices();
             }
         } else if (multiview_rendering_enabled()) {
             // Update left eye matrices as the 2D plane texture is drawn using the data from the left eye location
@@ -794,8 +1876,7 @@ namespace dx {
                 fixedfunction::current_projection_matrix[RightEye] = *pMatrix;
                 fixedfunction::current_projection_matrix[FocusRight] = *pMatrix;
 
-                update_btb_comparison_matrices(LeftEye, RightEye);
-                update_btb_comparison_matrices(FocusLeft, FocusRight);
+                invalidate_btb_comparison_matrices();
 
                 // Update right view because some other plugin may draw on the 2D plane
                 g::hooks::set_transform.call(g::d3d_dev, D3DTS_PROJECTION_RIGHT, pMatrix);
@@ -805,15 +1886,13 @@ namespace dx {
                 fixedfunction::current_view_matrix[RightEye] = *pMatrix;
                 fixedfunction::current_view_matrix[FocusRight] = *pMatrix;
 
-                update_btb_comparison_matrices(LeftEye, RightEye);
-                update_btb_comparison_matrices(FocusLeft, FocusRight);
+                invalidate_btb_comparison_matrices();
 
                 // Update right view because some other plugin may draw on the 2D plane
                 g::hooks::set_transform.call(g::d3d_dev, D3DTS_VIEW_RIGHT, pMatrix);
             } else if (State == D3DTS_WORLD) {
                 fixedfunction::current_world_matrix = *pMatrix;
-                update_btb_comparison_matrices(LeftEye, RightEye);
-                update_btb_comparison_matrices(FocusLeft, FocusRight);
+                invalidate_btb_comparison_matrices();
             }
         }
 
@@ -830,93 +1909,134 @@ namespace dx {
         return g::d3d_dev->SetRenderTarget(RenderTargetIndex, pRenderTarget);
     }
 
+    // Skipped draws are not recorded, as some of the conditions only hold while the game's render function runs
     HRESULT __stdcall DrawPrimitive(IDirect3DDevice9* This, D3DPRIMITIVETYPE PrimitiveType, UINT StartVertex, UINT PrimitiveCount)
     {
-        if (rbr::is_on_btb_stage()) {
-            IDirect3DVertexShader9* shader;
-            g::d3d_dev->GetVertexShader(&shader);
-
-            if (shader && !multiview_rendering_enabled()) {
-                // Shader #39 causes strange "shadows" on BTB stages
-                // Clearly visible during CFH, and otherwise visible too when looking up
-                // Probably some projection matrix issue, but changing the projection matrix like
-                // we do normally had no effect, so on BTB stages we just won't draw this primitive with this shader.
-                // With multiview this bug seems to not occur so we also do this exception when multiview isn't enabled.
-                auto should_skip_drawing = shader == g::base_game_shaders[39];
-                shader->Release();
-                if (should_skip_drawing) {
-                    return 0;
-                }
-            }
+        if (draw_classifier::skip({ shadow::vertex_shader, shadow::textures[0], 0, PrimitiveCount, PrimitiveType, false })) {
+            return 0;
         }
+        stereo_replay::record(stereo_replay::Op::DrawPrimitive, PrimitiveType, StartVertex, PrimitiveCount);
         return g::hooks::draw_primitive.call(This, PrimitiveType, StartVertex, PrimitiveCount);
     }
 
     HRESULT __stdcall DrawIndexedPrimitive(IDirect3DDevice9* This, D3DPRIMITIVETYPE PrimitiveType, INT BaseVertexIndex, UINT MinVertexIndex, UINT NumVertices, UINT startIndex, UINT primCount)
     {
-        IDirect3DVertexShader9* shader;
-        IDirect3DBaseTexture9* texture;
-        g::d3d_dev->GetVertexShader(&shader);
-        g::d3d_dev->GetTexture(0, &texture);
-        if (g::vr_render_target && !shader && !texture) {
-            if (!rbr::is_using_cockpit_camera()) {
-                // Don't draw these if we're not in a cockpit camera.
-                // In this mode, a black transparent square is drawn in front of the car
-                // if car shadows are enabled.
-                return 0;
-            }
-        } else {
-            if (shader) {
-                shader->Release();
-            }
-            if (texture)
-                texture->Release();
-            if (g::vr_render_target && rbr::is_rendering_wet_windscreen()) {
-                const bool is_windscreen = BaseVertexIndex == 0 && NumVertices == 4;
-                if (is_windscreen) {
-                    // TODO: This method of detecting the windscreen is quite bad.
-                    //
-                    // It would be better to detect it from the texture I think.
-                    // However, the texture is such that it is not loaded in the hooked
-                    // load_texture function. This will do unless some rendering bugs are found.
-                    //
-                    // We can't render the windscreen for two reasons:
-                    // - The windscreen needs to be rendered with cockpit projection to not clip it too early,
-                    //   but doing so makes its Z-values be wrong compared to the stage. Maybe another projection
-                    //   for it would work, but here comes the second point:
-                    // - It looks pretty bad anyway, and it is just a 2D plane floating somewhere in front of the
-                    //   opening for a windscreen. In VR where your FoV is large the effect does not really work
-                    //   that well.
-                    return 0;
-                }
-            }
+        if (draw_classifier::skip({ shadow::vertex_shader, shadow::textures[0], BaseVertexIndex, NumVertices, PrimitiveType, true })) {
+            return 0;
         }
+        stereo_replay::record(stereo_replay::Op::DrawIndexedPrimitive, PrimitiveType, BaseVertexIndex, MinVertexIndex, NumVertices, startIndex, primCount);
         return g::hooks::draw_indexed_primitive.call(g::d3d_dev, PrimitiveType, BaseVertexIndex, MinVertexIndex, NumVertices, startIndex, primCount);
     }
 
+    HRESULT __stdcall BeginStateBlock(IDirect3DDevice9* This)
+    {
+        // The calls until EndStateBlock don't change the device state, and can't be replayed as such
+        stereo_replay::mark_unsupported();
+
+        const auto ret = g::hooks::begin_state_block.call(This);
+        if (SUCCEEDED(ret)) {
+            shadow::recording_state_block = true;
+        }
+        return ret;
+    }
+
     HRESULT __stdcall EndStateBlock(IDirect3DDevice9* This, IDirect3DStateBlock9** ppSB)
     {
         const auto ret = g::hooks::end_state_block.call(This, ppSB);
+        shadow::recording_state_block = false;
 
-        auto vtbl = get_vtable<IDirect3DStateBlock9Vtbl>(*ppSB);
-        g::hooks::apply_state_block = Hook(vtbl->Apply, ApplyStateBlock);
-
-        // Remove the hook as IDirect3DStateBlock9::Apply is hooked
-        g::hooks::end_state_block.~Hook();
+        if (SUCCEEDED(ret) && !g::hooks::apply_state_block.src) {
+            // Apply is hooked in CreateDevice, unless creating a state block failed there.
+            // All state blocks share the same vtable, so IDirect3DStateBlock9::Apply needs to be hooked only once.
+            auto vtbl = get_vtable<IDirect3DStateBlock9Vtbl>(*ppSB);
+            g::hooks::apply_state_block = Hook(vtbl->Apply, ApplyStateBlock);
+        }
 
         return ret;
     }
 
     HRESULT __stdcall ApplyStateBlock(IDirect3DStateBlock9* This)
     {
+        stereo_replay::record(stereo_replay::Op::ApplyStateBlock, This);
+
         g::applying_state_block = true;
         const auto ret = g::hooks::apply_state_block.call(This);
         g::applying_state_block = false;
+
+        // State blocks don't contain render targets, but the shaders and textures may have changed
+        sync_shadow_state(false);
+        state_filter::invalidate();
+        constants::invalidate();
+        return ret;
+    }
+
+    HRESULT apply_untracked_state_block(IDirect3DStateBlock9* sb)
+    {
+        if (!g::hooks::apply_state_block.src) {
+            return sb->Apply();
+        }
+
+        g::applying_state_block = true;
+        const auto ret = g::hooks::apply_state_block.call(sb);
+        g::applying_state_block = false;
+
+        state_filter::invalidate();
+        return ret;
+    }
+
+    HRESULT __stdcall SetTexture(IDirect3DDevice9* This, DWORD Stage, IDirect3DBaseTexture9* pTexture)
+    {
+        stereo_replay::record(stereo_replay::Op::SetTexture, Stage, pTexture);
+        const auto ret = g::hooks::set_texture.call(This, Stage, pTexture);
+        if (SUCCEEDED(ret) && !shadow::recording_state_block && Stage < shadow::textures.size()) {
+            shadow::textures[Stage] = pTexture;
+        }
+        return ret;
+    }
+
+    HRESULT __stdcall SetRenderTarget(IDirect3DDevice9* This, DWORD RenderTargetIndex, IDirect3DSurface9* pRenderTarget)
+    {
+        stereo_replay::record(stereo_replay::Op::SetRenderTarget, RenderTargetIndex, stereo_replay::surface_ref(pRenderTarget));
+        const auto ret = g::hooks::set_render_target.call(This, RenderTargetIndex, pRenderTarget);
+        if (SUCCEEDED(ret) && RenderTargetIndex == 0) {
+            shadow::render_target = pRenderTarget;
+        }
+        return ret;
+    }
+
+    HRESULT __stdcall SetDepthStencilSurface(IDirect3DDevice9* This, IDirect3DSurface9* pNewZStencil)
+    {
+        stereo_replay::record(stereo_replay::Op::SetDepthStencilSurface, stereo_replay::surface_ref(pNewZStencil));
+        const auto ret = g::hooks::set_depth_stencil_surface.call(This, pNewZStencil);
+        if (SUCCEEDED(ret)) {
+            shadow::depth_stencil_surface = pNewZStencil;
+        }
         return ret;
     }
 
+    IDirect3DVertexShader9* current_vertex_shader()
+    {
+        return shadow::vertex_shader;
+    }
+
+    IDirect3DBaseTexture9* current_texture(DWORD stage)
+    {
+        return stage < shadow::textures.size() ? shadow::textures[stage] : nullptr;
+    }
+
+    IDirect3DSurface9* current_render_target()
+    {
+        return shadow::render_target;
+    }
+
+    IDirect3DSurface9* current_depth_stencil_surface()
+    {
+        return shadow::depth_stencil_surface;
+    }
+
     HRESULT __stdcall SetRenderState(IDirect3DDevice9* This, D3DRENDERSTATETYPE State, DWORD Value)
     {
+        stereo_replay::record(stereo_replay::Op::SetRenderState, State, Value);
         DWORD val = Value;
 
         if (rbr::should_use_reverse_z_buffer() && !g::applying_state_block) [[likely]] {
@@ -945,11 +2065,44 @@ namespace dx {
             }
         }
 
-        return g::hooks::set_render_state.call(This, State, val);
+        return state_filter::set_state(state_filter::render_states, state_filter::render_state_index(State), val, [=] {
+            return g::hooks::set_render_state.call(This, State, val);
+        });
+    }
+
+    HRESULT __stdcall SetSamplerState(IDirect3DDevice9* This, DWORD Sampler, D3DSAMPLERSTATETYPE Type, DWORD Value)
+    {
+        stereo_replay::record(stereo_replay::Op::SetSamplerState, Sampler, Type, Value);
+        return state_filter::set_state(state_filter::sampler_states, state_filter::sampler_state_index(Sampler, Type), Value, [=] {
+            return g::hooks::set_sampler_state.call(This, Sampler, Type, Value);
+        });
+    }
+
+    HRESULT __stdcall SetTextureStageState(IDirect3DDevice9* This, DWORD Stage, D3DTEXTURESTAGESTATETYPE Type, DWORD Value)
+    {
+        stereo_replay::record(stereo_replay::Op::SetTextureStageState, Stage, Type, Value);
+        return state_filter::set_state(state_filter::texture_stage_states, state_filter::texture_stage_state_index(Stage, Type), Value, [=] {
+            return g::hooks::set_texture_stage_state.call(This, Stage, Type, Value);
+        });
+    }
+
+    HRESULT __stdcall Reset(IDirect3DDevice9* This, D3DPRESENT_PARAMETERS* pPresentationParameters)
+    {
+        const auto ret = g::hooks::reset.call(This, pPresentationParameters);
+
+        // Reset sets all the states back to their defaults
+        state_filter::invalidate();
+        constants::invalidate();
+        if (SUCCEEDED(ret)) {
+            sync_shadow_state(true);
+        }
+        return ret;
     }
 
     HRESULT __stdcall Clear(IDirect3DDevice9* This, DWORD Count, const D3DRECT* pRects, DWORD Flags, D3DCOLOR Color, float Z, DWORD Stencil)
     {
+        stereo_replay::record(stereo_replay::Op::Clear, stereo_replay::Array<D3DRECT> { pRects, pRects ? Count : 0 }, Flags, Color, Z, Stencil);
+
         // Invert the Z value if reverse Z buffer is in use
 
         if (rbr::should_use_reverse_z_buffer()) [[likely]] {
@@ -959,6 +2112,373 @@ namespace dx {
         }
     }
 
+    HRESULT __stdcall SetStreamSource(IDirect3DDevice9* This, UINT StreamNumber, IDirect3DVertexBuffer9* pStreamData, UINT OffsetInBytes, UINT Stride)
+    {
+        stereo_replay::record(stereo_replay::Op::SetStreamSource, StreamNumber, pStreamData, OffsetInBytes, Stride);
+        return g::hooks::set_stream_source.call(This, StreamNumber, pStreamData, OffsetInBytes, Stride);
+    }
+
+    HRESULT __stdcall SetIndices(IDirect3DDevice9* This, IDirect3DIndexBuffer9* pIndexData)
+    {
+        stereo_replay::record(stereo_replay::Op::SetIndices, pIndexData);
+        return g::hooks::set_indices.call(This, pIndexData);
+    }
+
+    HRESULT __stdcall SetVertexDeclaration(IDirect3DDevice9* This, IDirect3DVertexDeclaration9* pDecl)
+    {
+        stereo_replay::record(stereo_replay::Op::SetVertexDeclaration, pDecl);
+        return g::hooks::set_vertex_declaration.call(This, pDecl);
+    }
+
+    HRESULT __stdcall SetFVF(IDirect3DDevice9* This, DWORD FVF)
+    {
+        stereo_replay::record(stereo_replay::Op::SetFVF, FVF);
+        return g::hooks::set_fvf.call(This, FVF);
+    }
+
+    HRESULT __stdcall SetPixelShader(IDirect3DDevice9* This, IDirect3DPixelShader9* pShader)
+    {
+        stereo_replay::record(stereo_replay::Op::SetPixelShader, pShader);
+        return g::hooks::set_pixel_shader.call(This, pShader);
+    }
+
+    HRESULT __stdcall SetPixelShaderConstantF(IDirect3DDevice9* This, UINT StartRegister, const float* pConstantData, UINT Vector4fCount)
+    {
+        stereo_replay::record(stereo_replay::Op::SetPixelShaderConstantF, StartRegister, stereo_replay::Array<float> { pConstantData, Vector4fCount * 4 });
+        return g::hooks::set_pixel_shader_constant_f.call(This, StartRegister, pConstantData, Vector4fCount);
+    }
+
+    HRESULT __stdcall SetViewport(IDirect3DDevice9* This, const D3DVIEWPORT9* pViewport)
+    {
+        if (pViewport) {
+            stereo_replay::record(stereo_replay::Op::SetViewport, *pViewport);
+        }
+        return g::hooks::set_viewport.call(This, pViewport);
+    }
+
+    HRESULT __stdcall SetMaterial(IDirect3DDevice9* This, const D3DMATERIAL9* pMaterial)
+    {
+        if (pMaterial) {
+            stereo_replay::record(stereo_replay::Op::SetMaterial, *pMaterial);
+        }
+        return g::hooks::set_material.call(This, pMaterial);
+    }
+
+    HRESULT __stdcall SetLight(IDirect3DDevice9* This, DWORD Index, const D3DLIGHT9* pLight)
+    {
+        if (pLight) {
+            stereo_replay::record(stereo_replay::Op::SetLight, Index, *pLight);
+        }
+        return g::hooks::set_light.call(This, Index, pLight);
+    }
+
+    HRESULT __stdcall LightEnable(IDirect3DDevice9* This, DWORD Index, BOOL Enable)
+    {
+        stereo_replay::record(stereo_replay::Op::LightEnable, Index, Enable);
+        return g::hooks::light_enable.call(This, Index, Enable);
+    }
+
+    HRESULT __stdcall SetScissorRect(IDirect3DDevice9* This, const RECT* pRect)
+    {
+        if (pRect) {
+            stereo_replay::record(stereo_replay::Op::SetScissorRect, *pRect);
+        }
+        return g::hooks::set_scissor_rect.call(This, pRect);
+    }
+
+    HRESULT __stdcall SetVertexShaderConstantI(IDirect3DDevice9* This, UINT StartRegister, const int* pConstantData, UINT Vector4iCount)
+    {
+        stereo_replay::record(stereo_replay::Op::SetVertexShaderConstantI, StartRegister, stereo_replay::Array<int> { pConstantData, Vector4iCount * 4 });
+        return g::hooks::set_vertex_shader_constant_i.call(This, StartRegister, pConstantData, Vector4iCount);
+    }
+
+    HRESULT __stdcall SetVertexShaderConstantB(IDirect3DDevice9* This, UINT StartRegister, const BOOL* pConstantData, UINT BoolCount)
+    {
+        stereo_replay::record(stereo_replay::Op::SetVertexShaderConstantB, StartRegister, stereo_replay::Array<BOOL> { pConstantData, BoolCount });
+        return g::hooks::set_vertex_shader_constant_b.call(This, StartRegister, pConstantData, BoolCount);
+    }
+
+    HRESULT __stdcall SetPixelShaderConstantI(IDirect3DDevice9* This, UINT StartRegister, const int* pConstantData, UINT Vector4iCount)
+    {
+        stereo_replay::record(stereo_replay::Op::SetPixelShaderConstantI, StartRegister, stereo_replay::Array<int> { pConstantData, Vector4iCount * 4 });
+        return g::hooks::set_pixel_shader_constant_i.call(This, StartRegister, pConstantData, Vector4iCount);
+    }
+
+    HRESULT __stdcall SetPixelShaderConstantB(IDirect3DDevice9* This, UINT StartRegister, const BOOL* pConstantData, UINT BoolCount)
+    {
+        stereo_replay::record(stereo_replay::Op::SetPixelShaderConstantB, StartRegister, stereo_replay::Array<BOOL> { pConstantData, BoolCount });
+        return g::hooks::set_pixel_shader_constant_b.call(This, StartRegister, pConstantData, BoolCount);
+    }
+
+    HRESULT __stdcall SetClipPlane(IDirect3DDevice9* This, DWORD Index, const float* pPlane)
+    {
+        if (pPlane) {
+            stereo_replay::record(stereo_replay::Op::SetClipPlane, Index, stereo_replay::Array<float> { pPlane, 4 });
+        }
+        return g::hooks::set_clip_plane.call(This, Index, pPlane);
+    }
+
+    HRESULT __stdcall SetStreamSourceFreq(IDirect3DDevice9* This, UINT StreamNumber, UINT Setting)
+    {
+        stereo_replay::record(stereo_replay::Op::SetStreamSourceFreq, StreamNumber, Setting);
+        return g::hooks::set_stream_source_freq.call(This, StreamNumber, Setting);
+    }
+
+    // Copies between surfaces may read or write the render targets of the eye, which can't be resolved to the other eye
+    HRESULT __stdcall StretchRect(IDirect3DDevice9* This, IDirect3DSurface9* pSourceSurface, const RECT* pSourceRect, IDirect3DSurface9* pDestSurface, const RECT* pDestRect, D3DTEXTUREFILTERTYPE Filter)
+    {
+        stereo_replay::mark_unsupported();
+        return g::hooks::stretch_rect.call(This, pSourceSurface, pSourceRect, pDestSurface, pDestRect, Filter);
+    }
+
+    HRESULT __stdcall ColorFill(IDirect3DDevice9* This, IDirect3DSurface9* pSurface, const RECT* pRect, D3DCOLOR color)
+    {
+        stereo_replay::mark_unsupported();
+        return g::hooks::color_fill.call(This, pSurface, pRect, color);
+    }
+
+    HRESULT __stdcall UpdateSurface(IDirect3DDevice9* This, IDirect3DSurface9* pSourceSurface, const RECT* pSourceRect, IDirect3DSurface9* pDestinationSurface, const POINT* pDestPoint)
+    {
+        stereo_replay::mark_unsupported();
+        return g::hooks::update_surface.call(This, pSourceSurface, pSourceRect, pDestinationSurface, pDestPoint);
+    }
+
+    HRESULT __stdcall UpdateTexture(IDirect3DDevice9* This, IDirect3DBaseTexture9* pSourceTexture, IDirect3DBaseTexture9* pDestinationTexture)
+    {
+        stereo_replay::mark_unsupported();
+        return g::hooks::update_texture.call(This, pSourceTexture, pDestinationTexture);
+    }
+
+    // The vertex data of the UP draws is not recorded
+    HRESULT __stdcall DrawPrimitiveUP(IDirect3DDevice9* This, D3DPRIMITIVETYPE PrimitiveType, UINT PrimitiveCount, const void* pVertexStreamZeroData, UINT VertexStreamZeroStride)
+    {
+        stereo_replay::mark_unsupported();
+        return g::hooks::draw_primitive_up.call(This, PrimitiveType, PrimitiveCount, pVertexStreamZeroData, VertexStreamZeroStride);
+    }
+
+    HRESULT __stdcall DrawIndexedPrimitiveUP(IDirect3DDevice9* This, D3DPRIMITIVETYPE PrimitiveType, UINT MinVertexIndex, UINT NumVertices, UINT PrimitiveCount, const void* pIndexData, D3DFORMAT IndexDataFormat, const void* pVertexStreamZeroData, UINT VertexStreamZeroStride)
+    {
+        stereo_replay::mark_unsupported();
+        return g::hooks::draw_indexed_primitive_up.call(This, PrimitiveType, MinVertexIndex, NumVertices, PrimitiveCount, pIndexData, IndexDataFormat, pVertexStreamZeroData, VertexStreamZeroStride);
+    }
+
+    // The game writes the dynamic buffers during the render function. The written data is recorded when the buffer is
+    // unlocked, and written again at the same point when the calls are replayed, so the draws see the same contents.
+    HRESULT __stdcall LockVertexBuffer(IDirect3DVertexBuffer9* This, UINT OffsetToLock, UINT SizeToLock, void** ppbData, DWORD Flags)
+    {
+        const auto ret = g::hooks::lock_vertex_buffer.call(This, OffsetToLock, SizeToLock, ppbData, Flags);
+        if (SUCCEEDED(ret) && !(Flags & D3DLOCK_READONLY) && stereo_replay::is_recording()) {
+            D3DVERTEXBUFFER_DESC desc;
+            if (SizeToLock == 0 && SUCCEEDED(This->GetDesc(&desc))) {
+                // Zero locks the rest of the buffer
+                SizeToLock = desc.Size - OffsetToLock;
+            }
+            stereo_replay::begin_buffer_write(This, OffsetToLock, SizeToLock, Flags, *ppbData);
+        }
+        return ret;
+    }
+
+    HRESULT __stdcall LockIndexBuffer(IDirect3DIndexBuffer9* This, UINT OffsetToLock, UINT SizeToLock, void** ppbData, DWORD Flags)
+    {
+        const auto ret = g::hooks::lock_index_buffer.call(This, OffsetToLock, SizeToLock, ppbData, Flags);
+        if (SUCCEEDED(ret) && !(Flags & D3DLOCK_READONLY) && stereo_replay::is_recording()) {
+            D3DINDEXBUFFER_DESC desc;
+            if (SizeToLock == 0 && SUCCEEDED(This->GetDesc(&desc))) {
+                SizeToLock = desc.Size - OffsetToLock;
+            }
+            stereo_replay::begin_buffer_write(This, OffsetToLock, SizeToLock, Flags, *ppbData);
+        }
+        return ret;
+    }
+
+    HRESULT __stdcall UnlockVertexBuffer(IDirect3DVertexBuffer9* This)
+    {
+        stereo_replay::end_buffer_write(stereo_replay::Op::WriteVertexBuffer, This);
+        return g::hooks::unlock_vertex_buffer.call(This);
+    }
+
+    HRESULT __stdcall UnlockIndexBuffer(IDirect3DIndexBuffer9* This)
+    {
+        stereo_replay::end_buffer_write(stereo_replay::Op::WriteIndexBuffer, This);
+        return g::hooks::unlock_index_buffer.call(This);
+    }
+
+    // Writes the data of a recorded buffer write to the buffer again
+    template <typename Buffer, typename Lock, typename Unlock>
+    static void replay_buffer_write(CommandBuffer::Reader& r, Lock lock, Unlock unlock)
+    {
+        const auto buffer = r.read<Buffer*>();
+        const auto offset = r.read<UINT>();
+        const auto flags = r.read<DWORD>();
+        uint32_t size;
+        const auto data = r.read_array<uint8_t>(size);
+        void* p;
+        if (SUCCEEDED(lock(buffer, offset, size, &p, flags))) {
+            std::memcpy(p, data, size);
+            unlock(buffer);
+        }
+    }
+
+    // Replays the calls recorded for the counterpart of `eye` with `eye` as the render target
+    static void replay_stereo_commands(const CommandBuffer& buffer, RenderTarget eye)
+    {
+        using stereo_replay::Op;
+
+        auto dev = g::d3d_dev;
+        stereo_replay::replaying = true;
+        buffer.for_each([&](const CommandBuffer::Command& cmd) {
+            CommandBuffer::Reader r(cmd.payload);
+            uint32_t n;
+            switch (static_cast<Op>(cmd.op)) {
+                case Op::SetTransform: {
+                    const auto state = r.read<D3DTRANSFORMSTATETYPE>();
+                    const auto m = r.read<D3DMATRIX>();
+                    SetTransform(dev, state, &m);
+                    break;
+                }
+                case Op::SetVertexShaderConstantF: {
+                    const auto reg = r.read<UINT>();
+                    const auto data = r.read_array<float>(n);
+                    SetVertexShaderConstantF(dev, reg, data, n / 4);
+                    break;
+                }
+                case Op::SetPixelShaderConstantF: {
+                    const auto reg = r.read<UINT>();
+                    const auto data = r.read_array<float>(n);
+                    SetPixelShaderConstantF(dev, reg, data, n / 4);
+                    break;
+                }
+                case Op::SetRenderState: {
+                    const auto state = r.read<D3DRENDERSTATETYPE>();
+                    SetRenderState(dev, state, r.read<DWORD>());
+                    break;
+                }
+                case Op::SetSamplerState: {
+                    const auto sampler = r.read<DWORD>();
+                    const auto type = r.read<D3DSAMPLERSTATETYPE>();
+                    SetSamplerState(dev, sampler, type, r.read<DWORD>());
+                    break;
+                }
+                case Op::SetTextureStageState: {
+                    const auto stage = r.read<DWORD>();
+                    const auto type = r.read<D3DTEXTURESTAGESTATETYPE>();
+                    SetTextureStageState(dev, stage, type, r.read<DWORD>());
+                    break;
+                }
+                case Op::SetTexture: {
+                    const auto stage = r.read<DWORD>();
+                    SetTexture(dev, stage, r.read<IDirect3DBaseTexture9*>());
+                    break;
+                }
+                case Op::SetVertexShader: SetVertexShader(dev, r.read<IDirect3DVertexShader9*>()); break;
+                case Op::SetPixelShader: SetPixelShader(dev, r.read<IDirect3DPixelShader9*>()); break;
+                case Op::SetVertexDeclaration: SetVertexDeclaration(dev, r.read<IDirect3DVertexDeclaration9*>()); break;
+                case Op::SetFVF: SetFVF(dev, r.read<DWORD>()); break;
+                case Op::SetStreamSource: {
+                    const auto stream = r.read<UINT>();
+                    const auto buf = r.read<IDirect3DVertexBuffer9*>();
+                    const auto offset = r.read<UINT>();
+                    SetStreamSource(dev, stream, buf, offset, r.read<UINT>());
+                    break;
+                }
+                case Op::SetIndices: SetIndices(dev, r.read<IDirect3DIndexBuffer9*>()); break;
+                case Op::SetViewport: {
+                    const auto viewport = r.read<D3DVIEWPORT9>();
+                    SetViewport(dev, &viewport);
+                    break;
+                }
+                case Op::SetMaterial: {
+                    const auto material = r.read<D3DMATERIAL9>();
+                    SetMaterial(dev, &material);
+                    break;
+                }
+                case Op::SetLight: {
+                    const auto index = r.read<DWORD>();
+                    const auto light = r.read<D3DLIGHT9>();
+                    SetLight(dev, index, &light);
+                    break;
+                }
+                case Op::LightEnable: {
+                    const auto index = r.read<DWORD>();
+                    LightEnable(dev, index, r.read<BOOL>());
+                    break;
+                }
+                case Op::SetRenderTarget: {
+                    const auto index = r.read<DWORD>();
+                    SetRenderTarget(dev, index, stereo_replay::resolve_surface(r.read<stereo_replay::SurfaceRef>(), eye));
+                    break;
+                }
+                case Op::SetDepthStencilSurface: SetDepthStencilSurface(dev, stereo_replay::resolve_surface(r.read<stereo_replay::SurfaceRef>(), eye)); break;
+                case Op::Clear: {
+                    const auto rects = r.read_array<D3DRECT>(n);
+                    const auto flags = r.read<DWORD>();
+                    const auto color = r.read<D3DCOLOR>();
+                    const auto z = r.read<float>();
+                    Clear(dev, n, n ? rects : nullptr, flags, color, z, r.read<DWORD>());
+                    break;
+                }
+                case Op::DrawPrimitive: {
+                    const auto type = r.read<D3DPRIMITIVETYPE>();
+                    const auto start = r.read<UINT>();
+                    DrawPrimitive(dev, type, start, r.read<UINT>());
+                    break;
+                }
+                case Op::DrawIndexedPrimitive: {
+                    const auto type = r.read<D3DPRIMITIVETYPE>();
+                    const auto base = r.read<INT>();
+                    const auto min = r.read<UINT>();
+                    const auto count = r.read<UINT>();
+                    const auto start = r.read<UINT>();
+                    DrawIndexedPrimitive(dev, type, base, min, count, start, r.read<UINT>());
+                    break;
+                }
+                case Op::ApplyStateBlock: ApplyStateBlock(r.read<IDirect3DStateBlock9*>()); break;
+                case Op::SetScissorRect: {
+                    const auto rect = r.read<RECT>();
+                    SetScissorRect(dev, &rect);
+                    break;
+                }
+                case Op::SetVertexShaderConstantI: {
+                    const auto reg = r.read<UINT>();
+                    const auto data = r.read_array<int>(n);
+                    SetVertexShaderConstantI(dev, reg, data, n / 4);
+                    break;
+                }
+                case Op::SetVertexShaderConstantB: {
+                    const auto reg = r.read<UINT>();
+                    const auto data = r.read_array<BOOL>(n);
+                    SetVertexShaderConstantB(dev, reg, data, n);
+                    break;
+                }
+                case Op::SetPixelShaderConstantI: {
+                    const auto reg = r.read<UINT>();
+                    const auto data = r.read_array<int>(n);
+                    SetPixelShaderConstantI(dev, reg, data, n / 4);
+                    break;
+                }
+                case Op::SetPixelShaderConstantB: {
+                    const auto reg = r.read<UINT>();
+                    const auto data = r.read_array<BOOL>(n);
+                    SetPixelShaderConstantB(dev, reg, data, n);
+                    break;
+                }
+                case Op::SetClipPlane: {
+                    const auto index = r.read<DWORD>();
+                    SetClipPlane(dev, index, r.read_array<float>(n));
+                    break;
+                }
+                case Op::SetStreamSourceFreq: {
+                    const auto stream = r.read<UINT>();
+                    SetStreamSourceFreq(dev, stream, r.read<UINT>());
+                    break;
+                }
+                case Op::WriteVertexBuffer: replay_buffer_write<IDirect3DVertexBuffer9>(r, LockVertexBuffer, UnlockVertexBuffer); break;
+                case Op::WriteIndexBuffer: replay_buffer_write<IDirect3DIndexBuffer9>(r, LockIndexBuffer, UnlockIndexBuffer); break;
+            }
+        });
+        stereo_replay::replaying = false;
+    }
+
     HRESULT __stdcall CreateDevice(
         IDirect3D9* This,
         UINT Adapter,
@@ -1015,13 +2535,73 @@ namespace dx {
             g::hooks::draw_primitive = Hook(devvtbl->DrawPrimitive, DrawPrimitive);
             g::hooks::set_render_state = Hook(devvtbl->SetRenderState, SetRenderState);
             g::hooks::clear = Hook(devvtbl->Clear, Clear);
+            g::hooks::begin_state_block = Hook(devvtbl->BeginStateBlock, BeginStateBlock);
             g::hooks::end_state_block = Hook(devvtbl->EndStateBlock, EndStateBlock);
+            g::hooks::set_texture = Hook(devvtbl->SetTexture, SetTexture);
+            g::hooks::set_render_target = Hook(devvtbl->SetRenderTarget, SetRenderTarget);
+            g::hooks::set_depth_stencil_surface = Hook(devvtbl->SetDepthStencilSurface, SetDepthStencilSurface);
+            g::hooks::set_sampler_state = Hook(devvtbl->SetSamplerState, SetSamplerState);
+            g::hooks::set_texture_stage_state = Hook(devvtbl->SetTextureStageState, SetTextureStageState);
+            g::hooks::reset = Hook(devvtbl->Reset, Reset);
+
+            // State blocks created with CreateStateBlock are applied without ever calling EndStateBlock.
+            // Hook IDirect3DStateBlock9::Apply right away, so the shadowed shaders, textures and constants
+            // and the cached states are invalidated for those too.
+            IDirect3DStateBlock9* sb;
+            if (SUCCEEDED(dev->CreateStateBlock(D3DSBT_PIXELSTATE, &sb))) {
+                g::hooks::apply_state_block = Hook(get_vtable<IDirect3DStateBlock9Vtbl>(sb)->Apply, ApplyStateBlock);
+                sb->Release();
+            }
+
+            if (g::cfg.experimental.stereo_replay) {
+                // Rest of the calls the render function makes, so all of them can be recorded
+                g::hooks::set_stream_source = Hook(devvtbl->SetStreamSource, SetStreamSource);
+                g::hooks::set_indices = Hook(devvtbl->SetIndices, SetIndices);
+                g::hooks::set_vertex_declaration = Hook(devvtbl->SetVertexDeclaration, SetVertexDeclaration);
+                g::hooks::set_fvf = Hook(devvtbl->SetFVF, SetFVF);
+                g::hooks::set_pixel_shader = Hook(devvtbl->SetPixelShader, SetPixelShader);
+                g::hooks::set_pixel_shader_constant_f = Hook(devvtbl->SetPixelShaderConstantF, SetPixelShaderConstantF);
+                g::hooks::set_viewport = Hook(devvtbl->SetViewport, SetViewport);
+                g::hooks::set_material = Hook(devvtbl->SetMaterial, SetMaterial);
+                g::hooks::set_light = Hook(devvtbl->SetLight, SetLight);
+                g::hooks::light_enable = Hook(devvtbl->LightEnable, LightEnable);
+                g::hooks::draw_primitive_up = Hook(devvtbl->DrawPrimitiveUP, DrawPrimitiveUP);
+                g::hooks::draw_indexed_primitive_up = Hook(devvtbl->DrawIndexedPrimitiveUP, DrawIndexedPrimitiveUP);
+                g::hooks::set_scissor_rect = Hook(devvtbl->SetScissorRect, SetScissorRect);
+                g::hooks::set_vertex_shader_constant_i = Hook(devvtbl->SetVertexShaderConstantI, SetVertexShaderConstantI);
+                g::hooks::set_vertex_shader_constant_b = Hook(devvtbl->SetVertexShaderConstantB, SetVertexShaderConstantB);
+                g::hooks::set_pixel_shader_constant_i = Hook(devvtbl->SetPixelShaderConstantI, SetPixelShaderConstantI);
+                g::hooks::set_pixel_shader_constant_b = Hook(devvtbl->SetPixelShaderConstantB, SetPixelShaderConstantB);
+                g::hooks::set_clip_plane = Hook(devvtbl->SetClipPlane, SetClipPlane);
+                g::hooks::set_stream_source_freq = Hook(devvtbl->SetStreamSourceFreq, SetStreamSourceFreq);
+                g::hooks::stretch_rect = Hook(devvtbl->StretchRect, StretchRect);
+                g::hooks::color_fill = Hook(devvtbl->ColorFill, ColorFill);
+                g::hooks::update_surface = Hook(devvtbl->UpdateSurface, UpdateSurface);
+                g::hooks::update_texture = Hook(devvtbl->UpdateTexture, UpdateTexture);
+
+                // All buffers of a type share the same vtable
+                IDirect3DVertexBuffer9* vb;
+                if (SUCCEEDED(dev->CreateVertexBuffer(16, 0, 0, D3DPOOL_MANAGED, &vb, nullptr))) {
+                    g::hooks::lock_vertex_buffer = Hook(get_vtable<IDirect3DVertexBuffer9Vtbl>(vb)->Lock, LockVertexBuffer);
+                    g::hooks::unlock_vertex_buffer = Hook(get_vtable<IDirect3DVertexBuffer9Vtbl>(vb)->Unlock, UnlockVertexBuffer);
+                    vb->Release();
+                }
+                IDirect3DIndexBuffer9* ib;
+                if (SUCCEEDED(dev->CreateIndexBuffer(16, 0, D3DFMT_INDEX16, D3DPOOL_MANAGED, &ib, nullptr))) {
+                    g::hooks::lock_index_buffer = Hook(get_vtable<IDirect3DIndexBuffer9Vtbl>(ib)->Lock, LockIndexBuffer);
+                    g::hooks::unlock_index_buffer = Hook(get_vtable<IDirect3DIndexBuffer9Vtbl>(ib)->Unlock, UnlockIndexBuffer);
+                    ib->Release();
+                }
+            }
         } catch (const std::runtime_error& e) {
             dbg(e.what());
             MessageBoxA(hFocusWindow, e.what(), "Hooking failed", MB_OK);
         }
 
         g::d3d_dev = dev;
+        sync_shadow_state(true);
+        state_filter::invalidate();
+        constants::invalidate();
 
         try {
             if (g::vr) {
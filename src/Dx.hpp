@@ -10,6 +10,19 @@ namespace dx {
     bool add_vertex_shader(IDirect3DVertexShader9* shader);
     void render_vr_eye(void* p, RenderTarget eye, bool clear = true);
     void free_btb_shaders();
+    // Applies the BTB shader patches started during the stage load. Called when the stage has loaded.
+    void finish_btb_stage_load();
+
+    // Currently bound vertex shader, texture, render target 0 and depth stencil surface. Not reference counted.
+    IDirect3DVertexShader9* current_vertex_shader();
+    IDirect3DBaseTexture9* current_texture(DWORD stage);
+    IDirect3DSurface9* current_render_target();
+    IDirect3DSurface9* current_depth_stencil_surface();
+
+    // Applies a state block of the plugin's own. The block must not contain vertex shaders or textures,
+    // which lets it skip reading the tracked state back from the device. It may set the pixel shader,
+    // which isn't tracked.
+    HRESULT apply_untracked_state_block(IDirect3DStateBlock9* sb);
 
     // Hooked functions
     HRESULT __stdcall CreateVertexShader(IDirect3DDevice9* This, const DWORD* pFunction, IDirect3DVertexShader9** ppShader);
@@ -21,7 +34,42 @@ namespace dx {
     HRESULT __stdcall DrawIndexedPrimitive(IDirect3DDevice9* This, D3DPRIMITIVETYPE PrimitiveType, INT BaseVertexIndex, UINT MinVertexIndex, UINT NumVertices, UINT startIndex, UINT primCount);
     HRESULT __stdcall CreateDevice(IDirect3D9* This, UINT Adapter, D3DDEVTYPE DeviceType, HWND hFocusWindow, DWORD BehaviorFlags, D3DPRESENT_PARAMETERS* pPresentationParameters, IDirect3DDevice9** ppReturnedDeviceInterface);
     HRESULT __stdcall SetRenderState(IDirect3DDevice9* This, D3DRENDERSTATETYPE State, DWORD Value);
+    HRESULT __stdcall SetSamplerState(IDirect3DDevice9* This, DWORD Sampler, D3DSAMPLERSTATETYPE Type, DWORD Value);
+    HRESULT __stdcall SetTextureStageState(IDirect3DDevice9* This, DWORD Stage, D3DTEXTURESTAGESTATETYPE Type, DWORD Value);
+    HRESULT __stdcall Reset(IDirect3DDevice9* This, D3DPRESENT_PARAMETERS* pPresentationParameters);
     HRESULT __stdcall Clear(IDirect3DDevice9* This, DWORD Count, const D3DRECT* pRects, DWORD Flags, D3DCOLOR Color, float Z, DWORD Stencil);
+    HRESULT __stdcall BeginStateBlock(IDirect3DDevice9* This);
+    HRESULT __stdcall EndStateBlock(IDirect3DDevice9* This, IDirect3DStateBlock9** ppSB);
     HRESULT __stdcall ApplyStateBlock(IDirect3DStateBlock9* This);
+    HRESULT __stdcall SetTexture(IDirect3DDevice9* This, DWORD Stage, IDirect3DBaseTexture9* pTexture);
+    HRESULT __stdcall SetRenderTarget(IDirect3DDevice9* This, DWORD RenderTargetIndex, IDirect3DSurface9* pRenderTarget);
+    HRESULT __stdcall SetDepthStencilSurface(IDirect3DDevice9* This, IDirect3DSurface9* pNewZStencil);
+    HRESULT __stdcall SetStreamSource(IDirect3DDevice9* This, UINT StreamNumber, IDirect3DVertexBuffer9* pStreamData, UINT OffsetInBytes, UINT Stride);
+    HRESULT __stdcall SetIndices(IDirect3DDevice9* This, IDirect3DIndexBuffer9* pIndexData);
+    HRESULT __stdcall SetVertexDeclaration(IDirect3DDevice9* This, IDirect3DVertexDeclaration9* pDecl);
+    HRESULT __stdcall SetFVF(IDirect3DDevice9* This, DWORD FVF);
+    HRESULT __stdcall SetPixelShader(IDirect3DDevice9* This, IDirect3DPixelShader9* pShader);
+    HRESULT __stdcall SetPixelShaderConstantF(IDirect3DDevice9* This, UINT StartRegister, const float* pConstantData, UINT Vector4fCount);
+    HRESULT __stdcall SetViewport(IDirect3DDevice9* This, const D3DVIEWPORT9* pViewport);
+    HRESULT __stdcall SetMaterial(IDirect3DDevice9* This, const D3DMATERIAL9* pMaterial);
+    HRESULT __stdcall SetLight(IDirect3DDevice9* This, DWORD Index, const D3DLIGHT9* pLight);
+    HRESULT __stdcall LightEnable(IDirect3DDevice9* This, DWORD Index, BOOL Enable);
+    HRESULT __stdcall SetScissorRect(IDirect3DDevice9* This, const RECT* pRect);
+    HRESULT __stdcall SetVertexShaderConstantI(IDirect3DDevice9* This, UINT StartRegister, const int* pConstantData, UINT Vector4iCount);
+    HRESULT __stdcall SetVertexShaderConstantB(IDirect3DDevice9* This, UINT StartRegister, const BOOL* pConstantData, UINT BoolCount);
+    HRESULT __stdcall SetPixelShaderConstantI(IDirect3DDevice9* This, UINT StartRegister, const int* pConstantData, UINT Vector4iCount);
+    HRESULT __stdcall SetPixelShaderConstantB(IDirect3DDevice9* This, UINT StartRegister, const BOOL* pConstantData, UINT BoolCount);
+    HRESULT __stdcall SetClipPlane(IDirect3DDevice9* This, DWORD Index, const float* pPlane);
+    HRESULT __stdcall SetStreamSourceFreq(IDirect3DDevice9* This, UINT StreamNumber, UINT Setting);
+    HRESULT __stdcall StretchRect(IDirect3DDevice9* This, IDirect3DSurface9* pSourceSurface, const RECT* pSourceRect, IDirect3DSurface9* pDestSurface, const RECT* pDestRect, D3DTEXTUREFILTERTYPE Filter);
+    HRESULT __stdcall ColorFill(IDirect3DDevice9* This, IDirect3DSurface9* pSurface, const RECT* pRect, D3DCOLOR color);
+    HRESULT __stdcall UpdateSurface(IDirect3DDevice9* This, IDirect3DSurface9* pSourceSurface, const RECT* pSourceRect, IDirect3DSurface9* pDestinationSurface, const POINT* pDestPoint);
+    HRESULT __stdcall UpdateTexture(IDirect3DDevice9* This, IDirect3DBaseTexture9* pSourceTexture, IDirect3DBaseTexture9* pDestinationTexture);
+    HRESULT __stdcall DrawPrimitiveUP(IDirect3DDevice9* This, D3DPRIMITIVETYPE PrimitiveType, UINT PrimitiveCount, const void* pVertexStreamZeroData, UINT VertexStreamZeroStride);
+    HRESULT __stdcall DrawIndexedPrimitiveUP(IDirect3DDevice9* This, D3DPRIMITIVETYPE PrimitiveType, UINT MinVertexIndex, UINT NumVertices, UINT PrimitiveCount, const void* pIndexData, D3DFORMAT IndexDataFormat, const void* pVertexStreamZeroData, UINT VertexStreamZeroStride);
+    HRESULT __stdcall LockVertexBuffer(IDirect3DVertexBuffer9* This, UINT OffsetToLock, UINT SizeToLock, void** ppbData, DWORD Flags);
+    HRESULT __stdcall LockIndexBuffer(IDirect3DIndexBuffer9* This, UINT OffsetToLock, UINT SizeToLock, void** ppbData, DWORD Flags);
+    HRESULT __stdcall UnlockVertexBuffer(IDirect3DVertexBuffer9* This);
+    HRESULT __stdcall UnlockIndexBuffer(IDirect3DIndexBuffer9* This);
     IDirect3D9* __stdcall Direct3DCreate9(UINT SDKVersion);
 }
@@ -0,0 +1,73 @@
+#include "FramePacer.hpp"
+
+#include <utility>
+
+FramePacer::FramePacer(WaitFrame wait_frame)
+    : wait_frame(std::move(wait_frame))
+{
+    thread = std::thread([this] { run(); });
+}
+
+FramePacer::~FramePacer()
+{
+    {
+        std::lock_guard lock(mtx);
+        quit = true;
+    }
+    cv.notify_all();
+    thread.join();
+}
+
+XrResult FramePacer::take(XrFrameState& state, std::chrono::steady_clock::time_point& time)
+{
+    std::unique_lock lock(mtx);
+    cv.wait(lock, [this] { return frame_state.has_value(); });
+    state = std::exchange(frame_state, std::nullopt).value();
+    time = published_at;
+    const auto res = result;
+    if (res != XR_SUCCESS) {
+        // The frame won't be begun, let the thread try again
+        may_wait = true;
+        lock.unlock();
+        cv.notify_all();
+    }
+    return res;
+}
+
+void FramePacer::frame_begun()
+{
+    {
+        std::lock_guard lock(mtx);
+        may_wait = true;
+    }
+    cv.notify_all();
+}
+
+void FramePacer::run()
+{
+    while (true) {
+        {
+            std::unique_lock lock(mtx);
+            cv.wait(lock, [this] { return quit || may_wait; });
+            if (quit) {
+                return;
+            }
+            may_wait = false;
+        }
+
+        // Blocks until the runtime wants the next frame, while the render thread works on the previous one
+        XrFrameState state = {
+            .type = XR_TYPE_FRAME_STATE,
+            .next = nullptr,
+        };
+        const auto res = wait_frame(state);
+
+        {
+            std::lock_guard lock(mtx);
+            frame_state = state;
+            result = res;
+            published_at = std::chrono::steady_clock::now();
+        }
+        cv.notify_all();
+    }
+}
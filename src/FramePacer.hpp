@@ -0,0 +1,49 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <openxr.h>
+#include <thread>
+
+// Calls xrWaitFrame on a thread of its own for the pipelined OpenXR frame loop
+//
+// The thread waits for the next frame while the render thread works on the
+// previous one, so the game's simulation and the CPU work of the frame overlap
+// the runtime's throttling. The frame state is published for the render thread,
+// which calls xrBeginFrame and xrEndFrame as usual. xrWaitFrame is called for the
+// next frame only after the previous one has been begun.
+class FramePacer {
+public:
+    using WaitFrame = std::function<XrResult(XrFrameState&)>;
+
+    explicit FramePacer(WaitFrame wait_frame);
+    // Returns once xrWaitFrame returns, if the thread is waiting for the runtime
+    ~FramePacer();
+    FramePacer(const FramePacer&) = delete;
+    FramePacer& operator=(const FramePacer&) = delete;
+
+    // Blocks until a frame state is published. `published_at` is set to the time xrWaitFrame returned it.
+    // If the result isn't XR_SUCCESS the frame won't be begun, and the thread waits for the next one right away.
+    XrResult take(XrFrameState& state, std::chrono::steady_clock::time_point& published_at);
+
+    // Lets the thread wait for the next frame. Called after xrBeginFrame.
+    void frame_begun();
+
+private:
+    void run();
+
+    WaitFrame wait_frame;
+    std::mutex mtx;
+    std::condition_variable cv;
+    // Frame state from the latest xrWaitFrame, not taken by the render thread yet
+    std::optional<XrFrameState> frame_state;
+    XrResult result = XR_SUCCESS;
+    std::chrono::steady_clock::time_point published_at;
+    // Set when the previous frame has been begun and xrWaitFrame may be called for the next one
+    bool may_wait = true;
+    bool quit = false;
+    std::thread thread;
+};
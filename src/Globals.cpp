@@ -42,8 +42,42 @@ namespace g {
         Hook<decltype(IDirect3DDevice9Vtbl::DrawPrimitive)> draw_primitive;
         Hook<decltype(IDirect3DDevice9Vtbl::SetRenderState)> set_render_state;
         Hook<decltype(IDirect3DDevice9Vtbl::Clear)> clear;
+        Hook<decltype(IDirect3DDevice9Vtbl::BeginStateBlock)> begin_state_block;
         Hook<decltype(IDirect3DDevice9Vtbl::EndStateBlock)> end_state_block;
         Hook<decltype(IDirect3DStateBlock9Vtbl::Apply)> apply_state_block;
+        Hook<decltype(IDirect3DDevice9Vtbl::SetTexture)> set_texture;
+        Hook<decltype(IDirect3DDevice9Vtbl::SetRenderTarget)> set_render_target;
+        Hook<decltype(IDirect3DDevice9Vtbl::SetDepthStencilSurface)> set_depth_stencil_surface;
+        Hook<decltype(IDirect3DDevice9Vtbl::SetSamplerState)> set_sampler_state;
+        Hook<decltype(IDirect3DDevice9Vtbl::SetTextureStageState)> set_texture_stage_state;
+        Hook<decltype(IDirect3DDevice9Vtbl::Reset)> reset;
+        Hook<decltype(IDirect3DDevice9Vtbl::SetStreamSource)> set_stream_source;
+        Hook<decltype(IDirect3DDevice9Vtbl::SetIndices)> set_indices;
+        Hook<decltype(IDirect3DDevice9Vtbl::SetVertexDeclaration)> set_vertex_declaration;
+        Hook<decltype(IDirect3DDevice9Vtbl::SetFVF)> set_fvf;
+        Hook<decltype(IDirect3DDevice9Vtbl::SetPixelShader)> set_pixel_shader;
+        Hook<decltype(IDirect3DDevice9Vtbl::SetPixelShaderConstantF)> set_pixel_shader_constant_f;
+        Hook<decltype(IDirect3DDevice9Vtbl::SetViewport)> set_viewport;
+        Hook<decltype(IDirect3DDevice9Vtbl::SetMaterial)> set_material;
+        Hook<decltype(IDirect3DDevice9Vtbl::SetLight)> set_light;
+        Hook<decltype(IDirect3DDevice9Vtbl::LightEnable)> light_enable;
+        Hook<decltype(IDirect3DDevice9Vtbl::DrawPrimitiveUP)> draw_primitive_up;
+        Hook<decltype(IDirect3DDevice9Vtbl::DrawIndexedPrimitiveUP)> draw_indexed_primitive_up;
+        Hook<decltype(IDirect3DVertexBuffer9Vtbl::Lock)> lock_vertex_buffer;
+        Hook<decltype(IDirect3DIndexBuffer9Vtbl::Lock)> lock_index_buffer;
+        Hook<decltype(IDirect3DVertexBuffer9Vtbl::Unlock)> unlock_vertex_buffer;
+        Hook<decltype(IDirect3DIndexBuffer9Vtbl::Unlock)> unlock_index_buffer;
+        Hook<decltype(IDirect3DDevice9Vtbl::SetScissorRect)> set_scissor_rect;
+        Hook<decltype(IDirect3DDevice9Vtbl::SetVertexShaderConstantI)> set_vertex_shader_constant_i;
+        Hook<decltype(IDirect3DDevice9Vtbl::SetVertexShaderConstantB)> set_vertex_shader_constant_b;
+        Hook<decltype(IDirect3DDevice9Vtbl::SetPixelShaderConstantI)> set_pixel_shader_constant_i;
+        Hook<decltype(IDirect3DDevice9Vtbl::SetPixelShaderConstantB)> set_pixel_shader_constant_b;
+        Hook<decltype(IDirect3DDevice9Vtbl::SetClipPlane)> set_clip_plane;
+        Hook<decltype(IDirect3DDevice9Vtbl::SetStreamSourceFreq)> set_stream_source_freq;
+        Hook<decltype(IDirect3DDevice9Vtbl::StretchRect)> stretch_rect;
+        Hook<decltype(IDirect3DDevice9Vtbl::ColorFill)> color_fill;
+        Hook<decltype(IDirect3DDevice9Vtbl::UpdateSurface)> update_surface;
+        Hook<decltype(IDirect3DDevice9Vtbl::UpdateTexture)> update_texture;
 
         // RBR functions
         Hook<decltype(&rbr::load_texture)> load_texture;
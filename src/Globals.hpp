@@ -121,8 +121,42 @@ namespace g {
         extern Hook<decltype(IDirect3DDevice9Vtbl::DrawPrimitive)> draw_primitive;
         extern Hook<decltype(IDirect3DDevice9Vtbl::SetRenderState)> set_render_state;
         extern Hook<decltype(IDirect3DDevice9Vtbl::Clear)> clear;
+        extern Hook<decltype(IDirect3DDevice9Vtbl::BeginStateBlock)> begin_state_block;
         extern Hook<decltype(IDirect3DDevice9Vtbl::EndStateBlock)> end_state_block;
         extern Hook<decltype(IDirect3DStateBlock9Vtbl::Apply)> apply_state_block;
+        extern Hook<decltype(IDirect3DDevice9Vtbl::SetTexture)> set_texture;
+        extern Hook<decltype(IDirect3DDevice9Vtbl::SetRenderTarget)> set_render_target;
+        extern Hook<decltype(IDirect3DDevice9Vtbl::SetDepthStencilSurface)> set_depth_stencil_surface;
+        extern Hook<decltype(IDirect3DDevice9Vtbl::SetSamplerState)> set_sampler_state;
+        extern Hook<decltype(IDirect3DDevice9Vtbl::SetTextureStageState)> set_texture_stage_state;
+        extern Hook<decltype(IDirect3DDevice9Vtbl::Reset)> reset;
+        extern Hook<decltype(IDirect3DDevice9Vtbl::SetStreamSource)> set_stream_source;
+        extern Hook<decltype(IDirect3DDevice9Vtbl::SetIndices)> set_indices;
+        extern Hook<decltype(IDirect3DDevice9Vtbl::SetVertexDeclaration)> set_vertex_declaration;
+        extern Hook<decltype(IDirect3DDevice9Vtbl::SetFVF)> set_fvf;
+        extern Hook<decltype(IDirect3DDevice9Vtbl::SetPixelShader)> set_pixel_shader;
+        extern Hook<decltype(IDirect3DDevice9Vtbl::SetPixelShaderConstantF)> set_pixel_shader_constant_f;
+        extern Hook<decltype(IDirect3DDevice9Vtbl::SetViewport)> set_viewport;
+        extern Hook<decltype(IDirect3DDevice9Vtbl::SetMaterial)> set_material;
+        extern Hook<decltype(IDirect3DDevice9Vtbl::SetLight)> set_light;
+        extern Hook<decltype(IDirect3DDevice9Vtbl::LightEnable)> light_enable;
+        extern Hook<decltype(IDirect3DDevice9Vtbl::DrawPrimitiveUP)> draw_primitive_up;
+        extern Hook<decltype(IDirect3DDevice9Vtbl::DrawIndexedPrimitiveUP)> draw_indexed_primitive_up;
+        extern Hook<decltype(IDirect3DVertexBuffer9Vtbl::Lock)> lock_vertex_buffer;
+        extern Hook<decltype(IDirect3DIndexBuffer9Vtbl::Lock)> lock_index_buffer;
+        extern Hook<decltype(IDirect3DVertexBuffer9Vtbl::Unlock)> unlock_vertex_buffer;
+        extern Hook<decltype(IDirect3DIndexBuffer9Vtbl::Unlock)> unlock_index_buffer;
+        extern Hook<decltype(IDirect3DDevice9Vtbl::SetScissorRect)> set_scissor_rect;
+        extern Hook<decltype(IDirect3DDevice9Vtbl::SetVertexShaderConstantI)> set_vertex_shader_constant_i;
+        extern Hook<decltype(IDirect3DDevice9Vtbl::SetVertexShaderConstantB)> set_vertex_shader_constant_b;
+        extern Hook<decltype(IDirect3DDevice9Vtbl::SetPixelShaderConstantI)> set_pixel_shader_constant_i;
+        extern Hook<decltype(IDirect3DDevice9Vtbl::SetPixelShaderConstantB)> set_pixel_shader_constant_b;
+        extern Hook<decltype(IDirect3DDevice9Vtbl::SetClipPlane)> set_clip_plane;
+        extern Hook<decltype(IDirect3DDevice9Vtbl::SetStreamSourceFreq)> set_stream_source_freq;
+        extern Hook<decltype(IDirect3DDevice9Vtbl::StretchRect)> stretch_rect;
+        extern Hook<decltype(IDirect3DDevice9Vtbl::ColorFill)> color_fill;
+        extern Hook<decltype(IDirect3DDevice9Vtbl::UpdateSurface)> update_surface;
+        extern Hook<decltype(IDirect3DDevice9Vtbl::UpdateTexture)> update_texture;
 
         // RBR functions
         extern Hook<decltype(&rbr::load_texture)> load_texture;
@@ -0,0 +1,214 @@
+#include "MatrixKernels.hpp"
+
+#include <cstring>
+#include <immintrin.h>
+
+#ifdef _WIN32
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+// The kernels don't use FMA even where it's available. Fused products are rounded
+// differently than the separate multiplies and adds of glm, which would make the
+// results differ from the matrices the game calculates.
+namespace matrix {
+    struct Kernels {
+        const char* name;
+        void (*multiply)(const float* a, const float* b, float* out);
+        void (*multiply_transpose)(const float* a, const float* b, float* out);
+        void (*multiply_transpose_n)(const float* a, const float* const* b, float* const* out, size_t n);
+    };
+
+    // SSE2
+    // The elements of `a` are broadcast where they're used. Keeping all 16 of them in registers would spill.
+
+    __attribute__((target("sse2"))) static void product_sse2(const float* a, const float* b, __m128* rows)
+    {
+        const auto b0 = _mm_loadu_ps(b + 0);
+        const auto b1 = _mm_loadu_ps(b + 4);
+        const auto b2 = _mm_loadu_ps(b + 8);
+        const auto b3 = _mm_loadu_ps(b + 12);
+
+        for (int i = 0; i < 4; ++i) {
+            // Same evaluation order as glm: ((a0 * b0 + a1 * b1) + a2 * b2) + a3 * b3
+            auto r = _mm_mul_ps(_mm_set1_ps(a[4 * i + 0]), b0);
+            r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a[4 * i + 1]), b1));
+            r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a[4 * i + 2]), b2));
+            r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a[4 * i + 3]), b3));
+            rows[i] = r;
+        }
+    }
+
+    __attribute__((target("sse2"))) static void store_transposed_sse2(__m128* rows, float* out)
+    {
+        _MM_TRANSPOSE4_PS(rows[0], rows[1], rows[2], rows[3]);
+        _mm_storeu_ps(out + 0, rows[0]);
+        _mm_storeu_ps(out + 4, rows[1]);
+        _mm_storeu_ps(out + 8, rows[2]);
+        _mm_storeu_ps(out + 12, rows[3]);
+    }
+
+    __attribute__((target("sse2"))) static void multiply_sse2(const float* a, const float* b, float* out)
+    {
+        __m128 rows[4];
+        product_sse2(a, b, rows);
+        for (int i = 0; i < 4; ++i) {
+            _mm_storeu_ps(out + 4 * i, rows[i]);
+        }
+    }
+
+    __attribute__((target("sse2"))) static void multiply_transpose_sse2(const float* a, const float* b, float* out)
+    {
+        __m128 rows[4];
+        product_sse2(a, b, rows);
+        store_transposed_sse2(rows, out);
+    }
+
+    __attribute__((target("sse2"))) static void multiply_transpose_n_sse2(const float* a, const float* const* b, float* const* out, size_t n)
+    {
+        __m128 rows[4];
+        for (size_t i = 0; i < n; ++i) {
+            product_sse2(a, b[i], rows);
+            store_transposed_sse2(rows, out[i]);
+        }
+    }
+
+    // AVX2
+    // Two rows of the result are calculated at once, one in each 128-bit lane. Like with SSE2,
+    // the elements of `a` are broadcast where they're used.
+
+    __attribute__((target("avx2"))) static __m256 load_row_pair_avx2(const float* row)
+    {
+        const auto r = _mm_loadu_ps(row);
+        return _mm256_insertf128_ps(_mm256_castps128_ps256(r), r, 1);
+    }
+
+    __attribute__((target("avx2"))) static void product_avx2(const float* a, const float* b, __m256* rows)
+    {
+        const auto b0 = load_row_pair_avx2(b + 0);
+        const auto b1 = load_row_pair_avx2(b + 4);
+        const auto b2 = load_row_pair_avx2(b + 8);
+        const auto b3 = load_row_pair_avx2(b + 12);
+
+        for (int p = 0; p < 2; ++p) {
+            // Broadcast each element of `a` within its row's lane
+            const auto a_rows = _mm256_loadu_ps(a + 8 * p);
+            auto r = _mm256_mul_ps(_mm256_permute_ps(a_rows, 0x00), b0);
+            r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_permute_ps(a_rows, 0x55), b1));
+            r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_permute_ps(a_rows, 0xAA), b2));
+            r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_permute_ps(a_rows, 0xFF), b3));
+            rows[p] = r;
+        }
+    }
+
+    __attribute__((target("avx2"))) static void store_transposed_avx2(const __m256* rows, float* out)
+    {
+        auto r0 = _mm256_castps256_ps128(rows[0]);
+        auto r1 = _mm256_extractf128_ps(rows[0], 1);
+        auto r2 = _mm256_castps256_ps128(rows[1]);
+        auto r3 = _mm256_extractf128_ps(rows[1], 1);
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+        _mm256_storeu_ps(out + 0, _mm256_insertf128_ps(_mm256_castps128_ps256(r0), r1, 1));
+        _mm256_storeu_ps(out + 8, _mm256_insertf128_ps(_mm256_castps128_ps256(r2), r3, 1));
+    }
+
+    __attribute__((target("avx2"))) static void multiply_avx2(const float* a, const float* b, float* out)
+    {
+        __m256 rows[2];
+        product_avx2(a, b, rows);
+        _mm256_storeu_ps(out + 0, rows[0]);
+        _mm256_storeu_ps(out + 8, rows[1]);
+    }
+
+    __attribute__((target("avx2"))) static void multiply_transpose_avx2(const float* a, const float* b, float* out)
+    {
+        __m256 rows[2];
+        product_avx2(a, b, rows);
+        store_transposed_avx2(rows, out);
+    }
+
+    __attribute__((target("avx2"))) static void multiply_transpose_n_avx2(const float* a, const float* const* b, float* const* out, size_t n)
+    {
+        __m256 rows[2];
+        for (size_t i = 0; i < n; ++i) {
+            product_avx2(a, b[i], rows);
+            store_transposed_avx2(rows, out[i]);
+        }
+    }
+
+    // Runtime selection
+
+    static void cpuid(int* info, int leaf, int subleaf)
+    {
+#ifdef _WIN32
+        __cpuidex(info, leaf, subleaf);
+#else
+        __cpuid_count(leaf, subleaf, info[0], info[1], info[2], info[3]);
+#endif
+    }
+
+    __attribute__((target("xsave"))) static bool os_supports_avx()
+    {
+        int info[4];
+        cpuid(info, 1, 0);
+        const auto osxsave = (info[2] & (1 << 27)) != 0;
+        const auto avx = (info[2] & (1 << 28)) != 0;
+
+        // The OS must save the upper halves of the YMM registers on context switches
+        return osxsave && avx && (_xgetbv(0) & 0x6) == 0x6;
+    }
+
+    static bool cpu_supports_avx2()
+    {
+        if (!os_supports_avx()) {
+            return false;
+        }
+
+        int info[4];
+        cpuid(info, 0, 0);
+        if (info[0] < 7) {
+            return false;
+        }
+        cpuid(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+    }
+
+    static constexpr Kernels sse2_kernels = { "SSE2", multiply_sse2, multiply_transpose_sse2, multiply_transpose_n_sse2 };
+    static constexpr Kernels avx2_kernels = { "AVX2", multiply_avx2, multiply_transpose_avx2, multiply_transpose_n_avx2 };
+
+    static const Kernels* kernels = cpu_supports_avx2() ? &avx2_kernels : &sse2_kernels;
+
+    void multiply(const float* a, const float* b, float* out)
+    {
+        kernels->multiply(a, b, out);
+    }
+
+    void multiply_transpose(const float* a, const float* b, float* out)
+    {
+        kernels->multiply_transpose(a, b, out);
+    }
+
+    void multiply_transpose_n(const float* a, const float* const* b, float* const* out, size_t n)
+    {
+        kernels->multiply_transpose_n(a, b, out, n);
+    }
+
+    const char* implementation()
+    {
+        return kernels->name;
+    }
+
+    bool select(const char* name)
+    {
+        if (strcmp(name, sse2_kernels.name) == 0) {
+            kernels = &sse2_kernels;
+            return true;
+        }
+        if (strcmp(name, avx2_kernels.name) == 0 && cpu_supports_avx2()) {
+            kernels = &avx2_kernels;
+            return true;
+        }
+        return false;
+    }
+}
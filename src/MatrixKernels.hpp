@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+
+// 4x4 matrix products with SSE2 and AVX2 implementations selected at runtime
+//
+// All matrices are 16 floats in the D3DMATRIX row-major layout. This is also the
+// memory layout of the M4 matrices returned by m4_from_d3d. The output must not
+// alias any of the inputs.
+//
+// The products are calculated in the same order and with the same rounding as the
+// scalar glm products. The BTB shader constants are compared byte by byte against
+// matrices calculated here, so the results must not depend on the selected kernel.
+namespace matrix {
+    // out = a * b
+    void multiply(const float* a, const float* b, float* out);
+
+    // out = (a * b)^T
+    void multiply_transpose(const float* a, const float* b, float* out);
+
+    // out[i] = (a * b[i])^T for each i < n
+    // Calculating the per-view matrices from a shared matrix in one pass avoids
+    // broadcasting the elements of `a` again for each view.
+    void multiply_transpose_n(const float* a, const float* const* b, float* const* out, size_t n);
+
+    // Name of the selected implementation
+    const char* implementation();
+
+    // Selects the implementation by name, for comparing them in the benchmark. The best one
+    // is selected when the DLL is loaded. Returns false if the CPU doesn't support it.
+    bool select(const char* name);
+}
@@ -74,30 +74,11 @@ void OpenVR::init(IDirect3DDevice9* dev, IDirect3DVR9** vrdev, uint32_t companio
     }
     g::d3d_vr->UnlockSubmissionQueue();
 
-    uint32_t w, h;
-    hmd->GetRecommendedRenderTargetSize(&w, &h);
-
-    // This can also be used to get a (slightly different) VR display size, if need arises
-    // if (vr::IVRExtendedDisplay* VRExtDisplay = vr::VRExtendedDisplay()) {
-    //	int32_t x, y;
-    // 	VRExtDisplay->GetWindowBounds(&x, &y, &w, &h);
-    // }
+    companion_window_width = companionWindowWidth;
+    companion_window_height = companionWindowHeight;
 
     try {
-        for (const auto& gfx : g::cfg.gfx) {
-            auto supersampling = gfx.second.supersampling;
-            auto wss = static_cast<uint32_t>(w * supersampling);
-            auto hss = static_cast<uint32_t>(h * supersampling);
-            RenderContext ctx = {
-                .width = { wss, wss },
-                .height = { hss, hss },
-                .msaa = gfx.second.msaa.value_or(g::cfg.gfx["default"].msaa.value()),
-                .quad_view_rendering = false,
-                .multiview_rendering = gfx.second.multiview_rendering,
-            };
-            init_surfaces(dev, ctx, companionWindowWidth, companionWindowHeight);
-            render_contexts[gfx.first] = ctx;
-        }
+        // The other render contexts are created when they're used
         set_render_context("default");
     } catch (const std::runtime_error& e) {
         dbg(e.what());
@@ -108,6 +89,33 @@ void OpenVR::init(IDirect3DDevice9* dev, IDirect3DVR9** vrdev, uint32_t companio
     dbg("VR init successful\n");
 }
 
+void OpenVR::create_render_context(IDirect3DDevice9* dev, const std::string& name)
+{
+    uint32_t w, h;
+    hmd->GetRecommendedRenderTargetSize(&w, &h);
+
+    // This can also be used to get a (slightly different) VR display size, if need arises
+    // if (vr::IVRExtendedDisplay* VRExtDisplay = vr::VRExtendedDisplay()) {
+    //	int32_t x, y;
+    // 	VRExtDisplay->GetWindowBounds(&x, &y, &w, &h);
+    // }
+
+    const auto& gfx = g::cfg.gfx[name];
+    auto supersampling = gfx.supersampling;
+    auto wss = static_cast<uint32_t>(w * supersampling);
+    auto hss = static_cast<uint32_t>(h * supersampling);
+
+    auto& ctx = render_contexts[name];
+    ctx = {
+        .width = { wss, wss },
+        .height = { hss, hss },
+        .msaa = gfx.msaa.value_or(g::cfg.gfx["default"].msaa.value()),
+        .quad_view_rendering = false,
+        .multiview_rendering = gfx.multiview_rendering,
+    };
+    init_surfaces(dev, ctx, static_cast<uint32_t>(companion_window_width), static_cast<uint32_t>(companion_window_height));
+}
+
 OpenVR::OpenVR()
     : hmd(nullptr)
     , compositor(nullptr)
@@ -12,6 +12,7 @@ private:
     D3D9_TEXTURE_VR_DESC dxvk_texture[2];
 
     constexpr M4 get_projection_matrix(RenderTarget eye, float z_near, float z_far, bool reverse_z);
+    void create_render_context(IDirect3DDevice9* dev, const std::string& name) override;
 
 public:
     OpenVR();
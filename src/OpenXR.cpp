@@ -522,7 +522,7 @@ void OpenXR::init(IDirect3DDevice9* dev, IDirect3DVR9** vrdev, uint32_t companio
         throw std::runtime_error("Failed to enumerate view config views");
     }
 
-    std::vector<XrViewConfigurationView> view_config_views(view_count, { .type = XR_TYPE_VIEW_CONFIGURATION_VIEW });
+    view_config_views.assign(view_count, { .type = XR_TYPE_VIEW_CONFIGURATION_VIEW });
     if (auto err = xrEnumerateViewConfigurationViews(instance, system_id, primary_view_config_type, view_count, &view_count, view_config_views.data()); err != XR_SUCCESS) {
         throw std::runtime_error("Failed to enumerate view config views");
     }
@@ -559,108 +559,19 @@ void OpenXR::init(IDirect3DDevice9* dev, IDirect3DVR9** vrdev, uint32_t companio
     }
     g::d3d_vr->ImportFence(cross_api_fence.shared_handle, cross_api_fence.value);
 
-    for (const auto& gfx : g::cfg.gfx) {
-        auto supersampling = gfx.second.supersampling;
-
-        OpenXRRenderContext* xr_ctx = new OpenXRRenderContext(view_config_views.size());
-        RenderContext ctx = {
-            .dx_shared_handle = { 0 },
-            .msaa = gfx.second.msaa.value_or(g::cfg.gfx["default"].msaa.value()),
-            .quad_view_rendering = gfx.second.quad_view_rendering,
-            .multiview_rendering = gfx.second.multiview_rendering,
-            .ext = xr_ctx
-        };
-
-        for (size_t i = 0; i < view_config_views.size(); ++i) {
-            ctx.width[i] = static_cast<uint32_t>(view_config_views[i].recommendedImageRectWidth * supersampling);
-            ctx.height[i] = static_cast<uint32_t>(view_config_views[i].recommendedImageRectHeight * supersampling);
-
-            XrSwapchainCreateInfo swapchain_create_info = {
-                .type = XR_TYPE_SWAPCHAIN_CREATE_INFO,
-                .createFlags = 0,
-                .usageFlags = XR_SWAPCHAIN_USAGE_COLOR_ATTACHMENT_BIT,
-                .format = swapchain_format,
-                .sampleCount = 1,
-                .width = ctx.width[i],
-                .height = ctx.height[i],
-                .faceCount = 1,
-                .arraySize = 1,
-                .mipCount = 1,
-            };
-            dbg(std::format("requesting swapchain: {}x{}, format {}", swapchain_create_info.width, swapchain_create_info.height, swapchain_create_info.format));
-
-            if (auto err = xrCreateSwapchain(session, &swapchain_create_info, &xr_ctx->swapchains[i]); err != XR_SUCCESS) {
-                throw std::runtime_error(std::format("VR init failed. xrCreateSwapchain: {}", XrResultToString(instance, err)));
-            }
-
-            uint32_t imageCount;
-            if (auto err = xrEnumerateSwapchainImages(xr_ctx->swapchains[i], 0, &imageCount, nullptr); err != XR_SUCCESS) {
-                throw std::runtime_error(std::format("Failed to initialize OpenXR: xrEnumerateSwapchainImages {}", XrResultToString(instance, err)));
-            }
-
-            xr_ctx->swapchain_images[i].resize(imageCount, { .type = XR_TYPE_SWAPCHAIN_IMAGE_D3D11_KHR });
-            if (auto err = xrEnumerateSwapchainImages(
-                    xr_ctx->swapchains[i],
-                    xr_ctx->swapchain_images[i].size(),
-                    &imageCount,
-                    reinterpret_cast<XrSwapchainImageBaseHeader*>(xr_ctx->swapchain_images[i].data()));
-                err != XR_SUCCESS) {
-                throw std::runtime_error(std::format("Failed to initialize OpenXR: xrEnumerateSwapchainImages {}", XrResultToString(instance, err)));
-            }
-
-            D3D11_TEXTURE2D_DESC desc = {
-                .Width = ctx.width[i],
-                .Height = ctx.height[i],
-                .MipLevels = 1,
-                .ArraySize = 1,
-                .Format = static_cast<DXGI_FORMAT>(swapchain_format),
-                .SampleDesc = 1,
-                .Usage = D3D11_USAGE_DEFAULT,
-                .BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE,
-                .CPUAccessFlags = 0,
-                .MiscFlags = D3D11_RESOURCE_MISC_SHARED | D3D11_RESOURCE_MISC_SHARED_NTHANDLE,
-            };
-
-            if (auto ret = g::d3d11_dev->CreateTexture2D(&desc, nullptr, &xr_ctx->shared_textures[i]); ret != D3D_OK) {
-                throw std::runtime_error(std::format("Failed to create shared texture: {}", ret));
-            }
-
-            IDXGIResource1* dxgi_res = nullptr;
-            if (auto ret = xr_ctx->shared_textures[i]->QueryInterface(__uuidof(IDXGIResource1), (void**)&dxgi_res); ret != D3D_OK) {
-                throw std::runtime_error(std::format("Failed to query interface IDXGIResource1: {}", ret));
-            }
-
-            if (auto ret = dxgi_res->CreateSharedHandle(nullptr, DXGI_SHARED_RESOURCE_READ | DXGI_SHARED_RESOURCE_WRITE, nullptr, &ctx.dx_shared_handle[i]); ret != D3D_OK) {
-                throw std::runtime_error(std::format("Failed to create shared handle: {}", ret));
-            }
-
-            dxgi_res->Release();
-        }
-
-        init_surfaces(dev, ctx, companion_window_width, companion_window_height);
-
-        for (size_t i = 0; i < xr_ctx->views.size(); ++i) {
-            xr_ctx->views[i] = { .type = XR_TYPE_VIEW };
-            xr_ctx->projection_views[i] = {
-                .type = XR_TYPE_COMPOSITION_LAYER_PROJECTION_VIEW,
-                .next = nullptr,
-                .subImage = {
-                    .swapchain = xr_ctx->swapchains[i],
-                    .imageRect = {
-                        .offset = { 0, 0 },
-                        .extent = {
-                            .width = static_cast<int>(ctx.width[i]),
-                            .height = static_cast<int>(ctx.height[i]),
-                        },
-                    },
-                    .imageArrayIndex = 0,
-                }
-            };
-        }
-
-        render_contexts[gfx.first] = ctx;
+    cross_api_fence.copy_value = 0;
+    if (auto ret = g::d3d11_dev->CreateFence(cross_api_fence.copy_value, D3D11_FENCE_FLAG_NONE, __uuidof(ID3D11Fence), reinterpret_cast<void**>(&cross_api_fence.copy_fence)); ret != D3D_OK) {
+        throw std::runtime_error(std::format("Failed to create fence: {}", ret));
+    }
+    cross_api_fence.event = CreateEventEx(nullptr, "Flush event", 0, EVENT_ALL_ACCESS);
+    if (!cross_api_fence.event) {
+        throw std::runtime_error("Failed to create fence event");
     }
 
+    this->companion_window_width = companion_window_width;
+    this->companion_window_height = companion_window_height;
+
+    // The other render contexts are created when they're used
     set_render_context("default");
 
     view_pose = old_view_pose.value_or(XrPosef { { 0, 0, 0, 1 }, { 0, 0, 0 } });
@@ -740,6 +651,10 @@ void OpenXR::init(IDirect3DDevice9* dev, IDirect3DVR9** vrdev, uint32_t companio
     eye_pos[RightEye] = glm::identity<glm::mat4x4>();
     eye_pos[FocusLeft] = glm::identity<glm::mat4x4>();
     eye_pos[FocusRight] = glm::identity<glm::mat4x4>();
+
+    if (g::cfg.experimental.pipelined_frame_loop) {
+        pacer = std::make_unique<FramePacer>([this](XrFrameState& state) { return xrWaitFrame(session, nullptr, &state); });
+    }
 }
 
 static std::optional<XrPath> xr_string_to_path(const XrInstance& instance, const std::string& path)
@@ -938,25 +853,295 @@ XrSwapchainImageD3D11KHR& OpenXR::acquire_swapchain_image(RenderTarget tgt)
     return xr_context()->swapchain_images[tgt][idx];
 }
 
-static void resolve_msaa(IDirect3DDevice9* dev, RenderContext* ctx, RenderTarget tgt)
+void OpenXR::create_render_context(IDirect3DDevice9* dev, const std::string& name)
 {
+    const auto& gfx = g::cfg.gfx[name];
+    auto supersampling = gfx.supersampling;
+
+    OpenXRRenderContext* xr_ctx = new OpenXRRenderContext(view_config_views.size());
+    auto& ctx = render_contexts[name];
+    ctx = {
+        .dx_shared_handle = { 0 },
+        .msaa = gfx.msaa.value_or(g::cfg.gfx["default"].msaa.value()),
+        .quad_view_rendering = gfx.quad_view_rendering,
+        .multiview_rendering = gfx.multiview_rendering,
+        .ext = xr_ctx
+    };
+
+    for (size_t i = 0; i < view_config_views.size(); ++i) {
+        ctx.width[i] = static_cast<uint32_t>(view_config_views[i].recommendedImageRectWidth * supersampling);
+        ctx.height[i] = static_cast<uint32_t>(view_config_views[i].recommendedImageRectHeight * supersampling);
+
+        XrSwapchainCreateInfo swapchain_create_info = {
+            .type = XR_TYPE_SWAPCHAIN_CREATE_INFO,
+            .createFlags = 0,
+            .usageFlags = XR_SWAPCHAIN_USAGE_COLOR_ATTACHMENT_BIT,
+            .format = swapchain_format,
+            .sampleCount = 1,
+            .width = ctx.width[i],
+            .height = ctx.height[i],
+            .faceCount = 1,
+            .arraySize = 1,
+            .mipCount = 1,
+        };
+        dbg(std::format("requesting swapchain: {}x{}, format {}", swapchain_create_info.width, swapchain_create_info.height, swapchain_create_info.format));
+
+        if (auto err = xrCreateSwapchain(session, &swapchain_create_info, &xr_ctx->swapchains[i]); err != XR_SUCCESS) {
+            throw std::runtime_error(std::format("VR init failed. xrCreateSwapchain: {}", XrResultToString(instance, err)));
+        }
+
+        uint32_t imageCount;
+        if (auto err = xrEnumerateSwapchainImages(xr_ctx->swapchains[i], 0, &imageCount, nullptr); err != XR_SUCCESS) {
+            throw std::runtime_error(std::format("Failed to initialize OpenXR: xrEnumerateSwapchainImages {}", XrResultToString(instance, err)));
+        }
+
+        xr_ctx->swapchain_images[i].resize(imageCount, { .type = XR_TYPE_SWAPCHAIN_IMAGE_D3D11_KHR });
+        if (auto err = xrEnumerateSwapchainImages(
+                xr_ctx->swapchains[i],
+                xr_ctx->swapchain_images[i].size(),
+                &imageCount,
+                reinterpret_cast<XrSwapchainImageBaseHeader*>(xr_ctx->swapchain_images[i].data()));
+            err != XR_SUCCESS) {
+            throw std::runtime_error(std::format("Failed to initialize OpenXR: xrEnumerateSwapchainImages {}", XrResultToString(instance, err)));
+        }
+
+        D3D11_TEXTURE2D_DESC desc = {
+            .Width = ctx.width[i],
+            .Height = ctx.height[i],
+            .MipLevels = 1,
+            .ArraySize = 1,
+            .Format = static_cast<DXGI_FORMAT>(swapchain_format),
+            .SampleDesc = 1,
+            .Usage = D3D11_USAGE_DEFAULT,
+            .BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE,
+            .CPUAccessFlags = 0,
+            .MiscFlags = D3D11_RESOURCE_MISC_SHARED | D3D11_RESOURCE_MISC_SHARED_NTHANDLE,
+        };
+
+        if (auto ret = g::d3d11_dev->CreateTexture2D(&desc, nullptr, &xr_ctx->shared_textures[i]); ret != D3D_OK) {
+            throw std::runtime_error(std::format("Failed to create shared texture: {}", ret));
+        }
+
+        IDXGIResource1* dxgi_res = nullptr;
+        if (auto ret = xr_ctx->shared_textures[i]->QueryInterface(__uuidof(IDXGIResource1), (void**)&dxgi_res); ret != D3D_OK) {
+            throw std::runtime_error(std::format("Failed to query interface IDXGIResource1: {}", ret));
+        }
+
+        if (auto ret = dxgi_res->CreateSharedHandle(nullptr, DXGI_SHARED_RESOURCE_READ | DXGI_SHARED_RESOURCE_WRITE, nullptr, &ctx.dx_shared_handle[i]); ret != D3D_OK) {
+            throw std::runtime_error(std::format("Failed to create shared handle: {}", ret));
+        }
+
+        dxgi_res->Release();
+    }
+
+    init_surfaces(dev, ctx, static_cast<uint32_t>(companion_window_width), static_cast<uint32_t>(companion_window_height));
+    if (g::cfg.experimental.zero_copy_submission) {
+        import_swapchain_images(dev, ctx, xr_ctx);
+    }
+    if (xr_ctx->imported_images.empty() && g::cfg.experimental.shared_texture_count > 1) {
+        create_shared_texture_ring(dev, ctx, xr_ctx);
+    }
+
+    for (size_t i = 0; i < xr_ctx->views.size(); ++i) {
+        xr_ctx->views[i] = { .type = XR_TYPE_VIEW };
+        xr_ctx->projection_views[i] = {
+            .type = XR_TYPE_COMPOSITION_LAYER_PROJECTION_VIEW,
+            .next = nullptr,
+            .subImage = {
+                .swapchain = xr_ctx->swapchains[i],
+                .imageRect = {
+                    .offset = { 0, 0 },
+                    .extent = {
+                        .width = static_cast<int>(ctx.width[i]),
+                        .height = static_cast<int>(ctx.height[i]),
+                    },
+                },
+                .imageArrayIndex = 0,
+            }
+        };
+    }
+
+    // The D3D11 side: the shared textures, the swapchain images and the rest of the shared texture ring
+    for (size_t i = 0; i < view_config_views.size(); ++i) {
+        const auto extra_textures = xr_ctx->shared_texture_ring.empty() ? 0 : xr_ctx->shared_texture_ring[i].size() - 1;
+        ctx.estimated_size += static_cast<uint64_t>(ctx.width[i]) * ctx.height[i] * 4 * (1 + xr_ctx->swapchain_images[i].size() + extra_textures);
+    }
+}
+
+void OpenXR::release_render_context(RenderContext& ctx)
+{
+    auto xr_ctx = reinterpret_cast<OpenXRRenderContext*>(ctx.ext);
+    if (xr_ctx) {
+        for (size_t i = 0; i < xr_ctx->swapchains.size(); ++i) {
+            if (xr_ctx->swapchains[i] != XR_NULL_HANDLE) {
+                xrDestroySwapchain(xr_ctx->swapchains[i]);
+            }
+            if (xr_ctx->shared_textures[i]) {
+                xr_ctx->shared_textures[i]->Release();
+            }
+        }
+        for (const auto& view : xr_ctx->shared_texture_ring) {
+            // The current textures are released above and with the render context's textures
+            for (size_t j = 0; j < view.size(); ++j) {
+                if (j != xr_ctx->shared_texture_index) {
+                    view[j].d3d11->Release();
+                    view[j].d3d9->Release();
+                }
+            }
+        }
+        for (const auto& view : xr_ctx->imported_images) {
+            for (auto texture : view) {
+                texture->Release();
+            }
+        }
+        delete xr_ctx;
+    }
+
+    VRInterface::release_render_context(ctx);
+}
+
+static IDirect3DTexture9* import_texture(IDirect3DDevice9* dev, ID3D11Texture2D* texture, uint32_t w, uint32_t h)
+{
+    IDXGIResource1* dxgi_res = nullptr;
+    if (texture->QueryInterface(__uuidof(IDXGIResource1), (void**)&dxgi_res) != D3D_OK) {
+        return nullptr;
+    }
+
+    HANDLE handle = nullptr;
+    const auto ret = dxgi_res->CreateSharedHandle(nullptr, DXGI_SHARED_RESOURCE_READ | DXGI_SHARED_RESOURCE_WRITE, nullptr, &handle);
+    dxgi_res->Release();
+    if (ret != D3D_OK) {
+        return nullptr;
+    }
+
+    IDirect3DTexture9* imported = nullptr;
+    if (dev->CreateTexture(w, h, 1, D3DUSAGE_RENDERTARGET, D3DFMT_X8B8G8R8, D3DPOOL_DEFAULT, &imported, &handle) != D3D_OK) {
+        imported = nullptr;
+    }
+    CloseHandle(handle);
+    return imported;
+}
+
+void OpenXR::import_swapchain_images(IDirect3DDevice9* dev, const RenderContext& ctx, OpenXRRenderContext* xr_ctx)
+{
+    std::vector<std::vector<IDirect3DTexture9*>> imported(xr_ctx->swapchain_images.size());
+    for (size_t i = 0; i < xr_ctx->swapchain_images.size(); ++i) {
+        for (const auto& image : xr_ctx->swapchain_images[i]) {
+            if (auto texture = import_texture(dev, image.texture, ctx.width[i], ctx.height[i]); texture) {
+                imported[i].push_back(texture);
+                continue;
+            }
+
+            // Runtimes don't have to create the images shareable, keep copying through the shared textures then
+            dbg(std::format("Could not import swapchain image of view {}, using the copy path", i));
+            for (const auto& view : imported) {
+                for (auto texture : view) {
+                    texture->Release();
+                }
+            }
+            return;
+        }
+    }
+
+    xr_ctx->imported_images = std::move(imported);
+}
+
+void OpenXR::create_shared_texture_ring(IDirect3DDevice9* dev, const RenderContext& ctx, OpenXRRenderContext* xr_ctx)
+{
+    const auto count = static_cast<size_t>(g::cfg.experimental.shared_texture_count);
+    std::vector<std::vector<OpenXRRenderContext::SharedTexture>> ring(xr_ctx->shared_textures.size());
+    for (size_t i = 0; i < ring.size(); ++i) {
+        // The textures created with the render context are the first ones
+        ring[i].push_back({ xr_ctx->shared_textures[i], ctx.dx_texture[i], 0 });
+
+        D3D11_TEXTURE2D_DESC desc;
+        xr_ctx->shared_textures[i]->GetDesc(&desc);
+        while (ring[i].size() < count) {
+            ID3D11Texture2D* texture = nullptr;
+            IDirect3DTexture9* imported = nullptr;
+            if (g::d3d11_dev->CreateTexture2D(&desc, nullptr, &texture) == D3D_OK) {
+                imported = import_texture(dev, texture, ctx.width[i], ctx.height[i]);
+            }
+            if (!imported) {
+                dbg(std::format("Could not create shared texture {} of view {}", ring[i].size(), i));
+                if (texture) {
+                    texture->Release();
+                }
+                for (const auto& view : ring) {
+                    for (size_t j = 1; j < view.size(); ++j) {
+                        view[j].d3d11->Release();
+                        view[j].d3d9->Release();
+                    }
+                }
+                return;
+            }
+            ring[i].push_back({ texture, imported, 0 });
+        }
+    }
+
+    xr_ctx->shared_texture_ring = std::move(ring);
+}
+
+void OpenXR::advance_shared_texture_ring()
+{
+    auto xr_ctx = xr_context();
+    if (xr_ctx->shared_texture_ring.empty()) {
+        return;
+    }
+
+    xr_ctx->shared_texture_index = (xr_ctx->shared_texture_index + 1) % xr_ctx->shared_texture_ring.front().size();
+    for (size_t i = 0; i < xr_ctx->shared_texture_ring.size(); ++i) {
+        const auto& next = xr_ctx->shared_texture_ring[i][xr_ctx->shared_texture_index];
+
+        // The textures are rendered to next, so D3D11 needs to be done reading them
+        wait_for_fence(cross_api_fence.copy_fence, next.copied);
+        xr_ctx->shared_textures[i] = next.d3d11;
+        current_render_context->dx_texture[i] = next.d3d9;
+    }
+}
+
+IDirect3DTexture9* OpenXR::get_texture(RenderTarget tgt) const
+{
+    // The current shared textures are being rendered to, the previous ones have the last complete frame
+    const auto xr_ctx = reinterpret_cast<const OpenXRRenderContext*>(current_render_context->ext);
+    if (tgt < xr_ctx->shared_texture_ring.size()) {
+        const auto& ring = xr_ctx->shared_texture_ring[tgt];
+        return ring[(xr_ctx->shared_texture_index + ring.size() - 1) % ring.size()].d3d9;
+    }
+    return VRInterface::get_texture(tgt);
+}
+
+// Resolves or copies the rendered view into `dst`
+// Views that were rendered straight into their texture are copied from the texture.
+static void resolve_msaa(IDirect3DDevice9* dev, RenderContext* ctx, RenderTarget tgt, IDirect3DTexture9* dst)
+{
+    IDirect3DSurface9* src = ctx->dx_surface[tgt];
+    if (!src && (dst == ctx->dx_texture[tgt] || ctx->dx_texture[tgt]->GetSurfaceLevel(0, &src) != D3D_OK)) {
+        return;
+    }
+
     IDirect3DSurface9* surface;
-    if (ctx->dx_texture[tgt]->GetSurfaceLevel(0, &surface) != D3D_OK) {
+    if (dst->GetSurfaceLevel(0, &surface) != D3D_OK) {
         dbg("Resolve MSAA: failed to get surface");
-        return;
+    } else {
+        dev->StretchRect(src, nullptr, surface, nullptr, D3DTEXF_NONE);
+        surface->Release();
+    }
+
+    if (src != ctx->dx_surface[tgt]) {
+        src->Release();
     }
-    dev->StretchRect(ctx->dx_surface[tgt], nullptr, surface, nullptr, D3DTEXF_NONE);
-    surface->Release();
 }
 
-static void copy_multiview_surfaces(RenderContext* ctx, RenderTarget left, RenderTarget right)
+// Copies the layers of the multiview render target of `left` into the textures
+static void copy_multiview_surfaces(RenderContext* ctx, RenderTarget left, IDirect3DTexture9* left_dst, IDirect3DTexture9* right_dst)
 {
     IDirect3DSurface9 *left_eye, *right_eye;
-    if (ctx->dx_texture[left]->GetSurfaceLevel(0, &left_eye) != D3D_OK) {
+    if (left_dst->GetSurfaceLevel(0, &left_eye) != D3D_OK) {
         dbg("Failed to get left eye surface");
         return;
     }
-    if (ctx->dx_texture[right]->GetSurfaceLevel(0, &right_eye) != D3D_OK) {
+    if (right_dst->GetSurfaceLevel(0, &right_eye) != D3D_OK) {
         dbg("Failed to get right eye surface");
         left_eye->Release();
         return;
@@ -969,20 +1154,26 @@ static void copy_multiview_surfaces(RenderContext* ctx, RenderTarget left, Rende
 
 void OpenXR::prepare_frames_for_hmd(IDirect3DDevice9* dev)
 {
+    fence_wait = 0.0f;
+    if (!xr_context()->imported_images.empty()) {
+        prepare_imported_frames_for_hmd(dev);
+        return;
+    }
+
     const auto msaa_enabled = current_render_context->msaa != D3DMULTISAMPLE_NONE;
     const auto peripheral_msaa_enabled = g::cfg.quad_view_rendering && g::cfg.peripheral_msaa != D3DMULTISAMPLE_NONE;
     if (dx::multiview_rendering_enabled()) {
         // MSAA is resolved in the process, if needed
-        copy_multiview_surfaces(g::vr->get_current_render_context(), LeftEye, RightEye);
+        copy_multiview_surfaces(current_render_context, LeftEye, current_render_context->dx_texture[LeftEye], current_render_context->dx_texture[RightEye]);
         if (g::cfg.quad_view_rendering) {
-            copy_multiview_surfaces(g::vr->get_current_render_context(), FocusLeft, FocusRight);
+            copy_multiview_surfaces(current_render_context, FocusLeft, current_render_context->dx_texture[FocusLeft], current_render_context->dx_texture[FocusRight]);
         }
     } else {
-        resolve_msaa(dev, current_render_context, LeftEye);
-        resolve_msaa(dev, current_render_context, RightEye);
+        resolve_msaa(dev, current_render_context, LeftEye, current_render_context->dx_texture[LeftEye]);
+        resolve_msaa(dev, current_render_context, RightEye, current_render_context->dx_texture[RightEye]);
         if (g::cfg.quad_view_rendering) {
-            resolve_msaa(dev, current_render_context, FocusLeft);
-            resolve_msaa(dev, current_render_context, FocusRight);
+            resolve_msaa(dev, current_render_context, FocusLeft, current_render_context->dx_texture[FocusLeft]);
+            resolve_msaa(dev, current_render_context, FocusRight, current_render_context->dx_texture[FocusRight]);
         }
     }
 
@@ -1036,20 +1227,104 @@ void OpenXR::prepare_frames_for_hmd(IDirect3DDevice9* dev)
     if (g::cfg.quad_view_rendering) {
         g::d3d11_ctx->CopyResource(focus_left.texture, xr_context()->shared_textures[FocusLeft]);
         g::d3d11_ctx->CopyResource(focus_right.texture, xr_context()->shared_textures[FocusRight]);
+    }
 
-        // Make sure D3D11 side of work is done before displaying the textures to the HMD
-        g::d3d11_ctx->Flush();
+    if (auto& ring = xr_context()->shared_texture_ring; !ring.empty()) {
+        g::d3d11_ctx->Signal(cross_api_fence.copy_fence, ++cross_api_fence.copy_value);
+        for (auto& view : ring) {
+            view[xr_context()->shared_texture_index].copied = cross_api_fence.copy_value;
+        }
+    }
+
+    // Make sure D3D11 side of work is done before displaying the textures to the HMD
+    g::d3d11_ctx->Flush();
 
+    if (g::cfg.quad_view_rendering) {
         xrReleaseSwapchainImage(xr_context()->swapchains[FocusLeft], &release_info);
         xrReleaseSwapchainImage(xr_context()->swapchains[FocusRight], &release_info);
-    } else {
-        // Make sure D3D11 side of work is done before displaying the textures to the HMD
-        g::d3d11_ctx->Flush();
     }
-
     xrReleaseSwapchainImage(xr_context()->swapchains[LeftEye], &release_info);
     xrReleaseSwapchainImage(xr_context()->swapchains[RightEye], &release_info);
 
+    advance_shared_texture_ring();
+
+    if (g::cfg.debug && perf_query_free_to_use) [[unlikely]] {
+        gpu_end_query->Issue(D3DISSUE_END);
+        gpu_disjoint_query->Issue(D3DISSUE_END);
+    }
+}
+
+// Resolves the views straight into the acquired swapchain images
+void OpenXR::prepare_imported_frames_for_hmd(IDirect3DDevice9* dev)
+{
+    const auto view_count = g::cfg.quad_view_rendering ? 4u : 2u;
+    const auto ctx = current_render_context;
+
+    XrSwapchainImageAcquireInfo acquire_info = {
+        .type = XR_TYPE_SWAPCHAIN_IMAGE_ACQUIRE_INFO,
+        .next = nullptr,
+    };
+    XrSwapchainImageWaitInfo info = {
+        .type = XR_TYPE_SWAPCHAIN_IMAGE_WAIT_INFO,
+        .next = nullptr,
+        .timeout = XR_INFINITE_DURATION,
+    };
+    XrSwapchainImageReleaseInfo release_info = {
+        .type = XR_TYPE_SWAPCHAIN_IMAGE_RELEASE_INFO,
+        .next = nullptr,
+    };
+
+    // The images are written to directly, so they need to be available before resolving
+    std::array<IDirect3DTexture9*, 4> images = {};
+    uint32_t acquired = 0;
+    // Images to release, also the one whose wait failed after it was acquired
+    uint32_t to_release = 0;
+    for (; acquired < view_count; ++acquired) {
+        const auto swapchain = xr_context()->swapchains[acquired];
+        uint32_t idx;
+        if (auto res = xrAcquireSwapchainImage(swapchain, &acquire_info, &idx); res != XR_SUCCESS) {
+            dbg(std::format("Could not acquire swapchain image: {}", XrResultToString(instance, res)));
+            break;
+        }
+        to_release = acquired + 1;
+        if (auto res = xrWaitSwapchainImage(swapchain, &info); res != XR_SUCCESS) {
+            dbg(std::format("xrWaitSwapchainImage ({}): {}", acquired, XrResultToString(instance, res)));
+            break;
+        }
+        images[acquired] = xr_context()->imported_images[acquired][idx];
+    }
+
+    if (acquired == view_count) {
+        if (dx::multiview_rendering_enabled()) {
+            copy_multiview_surfaces(ctx, LeftEye, images[LeftEye], images[RightEye]);
+            if (g::cfg.quad_view_rendering) {
+                copy_multiview_surfaces(ctx, FocusLeft, images[FocusLeft], images[FocusRight]);
+            }
+        } else {
+            for (uint32_t i = 0; i < view_count; ++i) {
+                resolve_msaa(dev, ctx, static_cast<RenderTarget>(i), images[i]);
+            }
+        }
+
+        // The companion window is drawn from the view's own texture
+        const auto companion_eye = static_cast<RenderTarget>(g::cfg.companion_eye + (is_using_quad_view_rendering() ? 2 : 0));
+        if (dx::multiview_rendering_enabled()) {
+            const auto left = companion_eye < FocusLeft ? LeftEye : FocusLeft;
+            copy_multiview_surfaces(ctx, left, ctx->dx_texture[left], ctx->dx_texture[render_target_counterpart(left)]);
+        } else {
+            resolve_msaa(dev, ctx, companion_eye, ctx->dx_texture[companion_eye]);
+        }
+
+        synchronize_graphics_apis();
+
+        // Make sure the D3D11 side waits for the rendering before the runtime reads the images
+        g::d3d11_ctx->Flush();
+    }
+
+    for (uint32_t i = 0; i < to_release; ++i) {
+        xrReleaseSwapchainImage(xr_context()->swapchains[i], &release_info);
+    }
+
     if (g::cfg.debug && perf_query_free_to_use) [[unlikely]] {
         gpu_end_query->Issue(D3DISSUE_END);
         gpu_disjoint_query->Issue(D3DISSUE_END);
@@ -1065,20 +1340,27 @@ void OpenXR::synchronize_graphics_apis(bool wait_for_cpu)
     g::d3d_vr->SignalFence(cross_api_fence.value);
     g::d3d_vr->UnlockSubmissionQueue();
 
+    if (auto ret = g::d3d11_ctx->Wait(cross_api_fence.fence, cross_api_fence.value); ret != D3D_OK) {
+        dbg(std::format("Failed to wait shared semaphore: {}", ret));
+    }
     if (wait_for_cpu) [[unlikely]] {
-        HANDLE evt = CreateEventEx(nullptr, "Flush event", 0, EVENT_ALL_ACCESS);
-        if (evt != INVALID_HANDLE_VALUE) {
-            cross_api_fence.fence->SetEventOnCompletion(cross_api_fence.value, evt);
-            if (auto ret = g::d3d11_ctx->Wait(cross_api_fence.fence, cross_api_fence.value); ret != D3D_OK) {
-                dbg(std::format("Failed to wait shared semaphore: {}", ret));
-            }
-            WaitForSingleObject(evt, INFINITE);
-        }
+        wait_for_fence(cross_api_fence.fence, cross_api_fence.value);
+    }
+}
+
+void OpenXR::wait_for_fence(ID3D11Fence* fence, uint64_t value)
+{
+    if (fence->GetCompletedValue() >= value) {
+        return;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    if (auto ret = fence->SetEventOnCompletion(value, cross_api_fence.event); ret == D3D_OK) {
+        WaitForSingleObject(cross_api_fence.event, INFINITE);
     } else {
-        if (auto ret = g::d3d11_ctx->Wait(cross_api_fence.fence, cross_api_fence.value); ret != D3D_OK) {
-            dbg(std::format("Failed to wait shared semaphore: {}", ret));
-        }
+        dbg(std::format("Failed to wait for fence: {}", ret));
     }
+    fence_wait += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
 }
 
 void OpenXR::submit_frames_to_hmd(IDirect3DDevice9* dev)
@@ -1178,18 +1460,34 @@ std::optional<XrViewState> OpenXR::update_views()
     return view_state;
 }
 
+XrResult OpenXR::wait_frame(std::chrono::steady_clock::time_point& frame_state_time)
+{
+    const auto wait_start = std::chrono::steady_clock::now();
+    XrResult res;
+
+    if (!pacer) {
+        frame_state = {
+            .type = XR_TYPE_FRAME_STATE,
+            .next = nullptr,
+        };
+        res = xrWaitFrame(session, nullptr, &frame_state);
+        frame_state_time = std::chrono::steady_clock::now();
+    } else {
+        res = pacer->take(frame_state, frame_state_time);
+    }
+
+    frame_wait = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - wait_start).count();
+    return res;
+}
+
 bool OpenXR::update_vr_poses()
 {
     if (g::cfg.openxr_motion_compensation) {
         update_hand_poses();
     }
 
-    frame_state = {
-        .type = XR_TYPE_FRAME_STATE,
-        .next = nullptr,
-    };
-
-    if (auto res = xrWaitFrame(session, nullptr, &frame_state); res != XR_SUCCESS) {
+    std::chrono::steady_clock::time_point frame_state_time;
+    if (auto res = wait_frame(frame_state_time); res != XR_SUCCESS) {
         dbg(std::format("xrWaitFrame: {}", XrResultToString(instance, res)));
         return false;
     }
@@ -1227,7 +1525,12 @@ bool OpenXR::update_vr_poses()
         dbg(std::format("xrBeginFrame: {}", XrResultToString(instance, res)));
     }
 
+    if (pacer) {
+        pacer->frame_begun();
+    }
+
     update_poses();
+    pose_age = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - frame_state_time).count();
 
     if (g::cfg.debug && perf_query_free_to_use) [[unlikely]] {
         gpu_disjoint_query->Issue(D3DISSUE_BEGIN);
@@ -1273,6 +1576,9 @@ void OpenXR::update_poses()
 FrameTimingInfo OpenXR::get_frame_timing()
 {
     FrameTimingInfo ret = { 0 };
+    ret.frame_wait = frame_wait;
+    ret.pose_age = pose_age;
+    ret.fence_wait = fence_wait;
 
     BOOL disjoint;
     uint64_t gpu_start, gpu_end;
@@ -1373,9 +1679,12 @@ void OpenXR::recenter_view()
 
 void OpenXR::shutdown_vr()
 {
+    pacer.reset();
     synchronize_graphics_apis(true);
     g::d3d_vr->WaitDeviceIdle(true);
     cross_api_fence.fence->Release();
+    cross_api_fence.copy_fence->Release();
+    CloseHandle(cross_api_fence.event);
 
     if (g::cfg.openxr_motion_compensation) {
         // TODO: More cleanup?
@@ -1386,30 +1695,10 @@ void OpenXR::shutdown_vr()
     xrDestroySpace(space);
     xrDestroySpace(view_space);
 
-    for (const auto& v : render_contexts) {
-        const auto& ctx = v.second;
-
-        for (int i = 0; i < 6; ++i) {
-            if (ctx.dx_texture[i]) {
-                ctx.dx_texture[i]->Release();
-            }
-            if (ctx.dx_surface[i]) {
-                ctx.dx_surface[i]->Release();
-            }
-            if (ctx.dx_depth_stencil_surface[i]) {
-                ctx.dx_depth_stencil_surface[i]->Release();
-            }
-            if (i < 4 && ctx.dx_shared_handle[i] != nullptr && ctx.dx_shared_handle != INVALID_HANDLE_VALUE) {
-                CloseHandle(ctx.dx_shared_handle[i]);
-            }
-        }
-
-        auto xr_ctx = reinterpret_cast<OpenXRRenderContext*>(ctx.ext);
-        for (size_t i = 0; i < xr_ctx->swapchains.size(); ++i) {
-            xrDestroySwapchain(xr_ctx->swapchains[i]);
-            xr_ctx->shared_textures[i]->Release();
-        }
+    for (auto& v : render_contexts) {
+        release_render_context(v.second);
     }
+    render_contexts.clear();
 
     xrDestroySession(session);
     xrDestroyInstance(instance);
@@ -10,9 +10,12 @@
 #include <optional>
 
 #include "Config.hpp"
+#include "FramePacer.hpp"
 #include "VR.hpp"
 #include <array>
+#include <chrono>
 #include <d3d9.h>
+#include <memory>
 
 struct OpenXRRenderContext {
     std::vector<XrSwapchain> swapchains;
@@ -20,6 +23,20 @@ struct OpenXRRenderContext {
     std::vector<std::vector<XrSwapchainImageD3D11KHR>> swapchain_images;
     std::vector<XrView> views;
     std::vector<XrCompositionLayerProjectionView> projection_views;
+    // Swapchain images imported into D3D9, so the views can be resolved into them without a D3D11 copy.
+    // Empty if the runtime's images couldn't be shared.
+    std::vector<std::vector<IDirect3DTexture9*>> imported_images;
+
+    struct SharedTexture {
+        ID3D11Texture2D* d3d11;
+        IDirect3DTexture9* d3d9;
+        // Value of the copy fence after the texture was last copied from
+        uint64_t copied;
+    };
+    // Shared textures of each view, used in turns so that the D3D11 copy of a frame doesn't read the textures the
+    // next frame renders to. shared_textures and the render context's textures point to the current ones.
+    std::vector<std::vector<SharedTexture>> shared_texture_ring;
+    size_t shared_texture_index = 0;
 
     OpenXRRenderContext(size_t view_count)
         : swapchains(view_count)
@@ -55,6 +72,7 @@ private:
     int64_t swapchain_format;
     XrPosef view_pose;
     XrViewConfigurationType primary_view_config_type;
+    std::vector<XrViewConfigurationView> view_config_views;
     InputState input_state; // For sending poses to OpenXR-MotionCompensation https://github.com/BuzzteeBear/OpenXR-MotionCompensation
     bool reset_view_requested;
 
@@ -64,11 +82,27 @@ private:
         uint64_t value;
         ID3D11Fence* fence;
         HANDLE shared_handle;
+        // Signaled by D3D11 after the shared textures have been copied
+        uint64_t copy_value;
+        ID3D11Fence* copy_fence;
+        // Used for all the waits on the CPU
+        HANDLE event;
     } cross_api_fence;
 
+    // Time spent waiting for the fences on the CPU during the frame. Milliseconds.
+    float fence_wait = 0.0f;
+
     std::vector<char> device_extensions;
     std::vector<char> instance_extensions;
 
+    // Pipelined frame loop: xrWaitFrame is called on the pacer's thread. Not set if the frame loop isn't pipelined.
+    std::unique_ptr<FramePacer> pacer;
+
+    // Time the render thread spent waiting for the frame, and the age of the frame state
+    // when the poses were located from it. Milliseconds.
+    float frame_wait = 0.0f;
+    float pose_age = 0.0f;
+
     bool perf_query_free_to_use = true;
     IDirect3DQuery9* gpu_start_query;
     IDirect3DQuery9* gpu_end_query;
@@ -76,11 +110,19 @@ private:
     IDirect3DQuery9* gpu_freq_query;
 
     XrSwapchainImageD3D11KHR& acquire_swapchain_image(RenderTarget tgt);
+    void create_render_context(IDirect3DDevice9* dev, const std::string& name) override;
+    void release_render_context(RenderContext& ctx) override;
+    XrResult wait_frame(std::chrono::steady_clock::time_point& frame_state_time);
+    void import_swapchain_images(IDirect3DDevice9* dev, const RenderContext& ctx, OpenXRRenderContext* xr_ctx);
+    void prepare_imported_frames_for_hmd(IDirect3DDevice9* dev);
     std::optional<XrViewState> update_views();
     void update_poses();
     bool get_projection_matrix(XrViewState view_state);
     void recenter_view();
     void synchronize_graphics_apis(bool wait_for_cpu = false);
+    void wait_for_fence(ID3D11Fence* fence, uint64_t value);
+    void create_shared_texture_ring(IDirect3DDevice9* dev, const RenderContext& ctx, OpenXRRenderContext* xr_ctx);
+    void advance_shared_texture_ring();
     OpenXRRenderContext* xr_context()
     {
         return reinterpret_cast<OpenXRRenderContext*>(current_render_context->ext);
@@ -111,6 +153,7 @@ public:
     void prepare_frames_for_hmd(IDirect3DDevice9* dev) override;
     void submit_frames_to_hmd(IDirect3DDevice9* dev) override;
     void reset_view() override;
+    IDirect3DTexture9* get_texture(RenderTarget tgt) const override;
     FrameTimingInfo get_frame_timing() override;
     VRRuntime get_runtime_type() const override { return OPENXR; }
 
@@ -393,6 +393,11 @@ namespace rbr {
         if (game_mode != g::game_mode) [[unlikely]] {
             g::previous_game_mode = g::game_mode;
             g::game_mode = game_mode;
+
+            if (g::previous_game_mode == GameMode::Loading && is_on_btb_stage()) {
+                // The shaders need to be ready before the first frame of the stage is rendered
+                dx::finish_btb_stage_load();
+            }
         }
 
         if (g::previous_game_mode != g::game_mode && (g::game_mode == GameMode::PreStage || g::game_mode == GameMode::Pause)) {
@@ -480,6 +485,7 @@ namespace rbr {
             g::stage_recenter_frame_counter = 0;
             g::current_stage_id = *g::stage_id_ptr;
             g::seat_position_loaded = false;
+            // Creates the stage's render context if it doesn't exist, before the stage is loaded
             update_render_context();
         }
 
@@ -556,12 +562,8 @@ namespace rbr {
     {
         auto do_rendering = init_or_update_game_data(reinterpret_cast<uintptr_t>(p));
 
-        if (g::d3d_dev->GetRenderTarget(0, &g::original_render_target) != D3D_OK) [[unlikely]] {
-            dbg("Could not get render original target");
-        }
-        if (g::d3d_dev->GetDepthStencilSurface(&g::original_depth_stencil_target) != D3D_OK) [[unlikely]] {
-            dbg("Could not get render original depth stencil surface");
-        }
+        g::original_render_target = dx::current_render_target();
+        g::original_depth_stencil_target = dx::current_depth_stencil_surface();
 
         if (!do_rendering) [[unlikely]] {
             return;
@@ -574,6 +576,7 @@ namespace rbr {
                 g::vr_error = true;
                 return;
             }
+            g::vr->update_frame_matrices(get_horizon_lock_matrix());
 
             g::frame_start = std::chrono::steady_clock::now();
 
@@ -1,6 +1,9 @@
 #include "RenderTarget.hpp"
 #include "Globals.hpp"
 
+#include <algorithm>
+#include <vector>
+
 static bool is_aa_enabled_for_render_target(D3DMULTISAMPLE_TYPE msaa, RenderTarget t)
 {
     if (g::vr && g::vr->is_using_quad_view_rendering()) {
@@ -44,6 +47,64 @@ static D3DMULTISAMPLE_TYPE get_msaa_for_render_target(RenderTarget t, D3DMULTISA
     return D3DMULTISAMPLE_NONE;
 }
 
+// Surfaces and textures of the render contexts are shared between the contexts whose descriptors match.
+// Only one render context is rendered to at a time, so the contents don't need to be kept.
+// The render target is part of the key so that the views of a single context never share a surface.
+enum class PooledKind : uint8_t {
+    RenderTarget,
+    Texture,
+    DepthStencil,
+};
+
+struct PoolKey {
+    PooledKind kind;
+    RenderTarget tgt;
+    uint32_t w;
+    uint32_t h;
+    D3DFORMAT fmt;
+    D3DMULTISAMPLE_TYPE msaa;
+    bool multiview;
+
+    bool operator==(const PoolKey& rhs) const = default;
+};
+
+struct PoolEntry {
+    PoolKey key;
+    IUnknown* resource;
+    // Number of render contexts using the resource
+    uint32_t users;
+    uint64_t size;
+};
+
+namespace {
+    std::vector<PoolEntry> render_target_pool;
+}
+
+// Approximate size, all the formats used are 32 bits per sample
+static uint64_t pooled_size(const PoolKey& key)
+{
+    const uint64_t samples = std::max<uint64_t>(key.msaa, 1);
+    return static_cast<uint64_t>(key.w) * key.h * 4 * samples * (key.multiview ? 2 : 1);
+}
+
+// Returns a pooled resource matching `key` and adds a user for it, or nullptr if there isn't one
+template <typename T>
+static T* find_pooled(const PoolKey& key)
+{
+    for (auto& entry : render_target_pool) {
+        if (entry.key == key) {
+            entry.users++;
+            return static_cast<T*>(entry.resource);
+        }
+    }
+    return nullptr;
+}
+
+static void add_pooled(const PoolKey& key, IUnknown* resource)
+{
+    render_target_pool.push_back({ key, resource, 1, pooled_size(key) });
+}
+
 bool create_render_target(
     IDirect3DDevice9* dev,
     D3DMULTISAMPLE_TYPE msaa_in,
@@ -64,13 +125,30 @@ bool create_render_target(
     // If anti-aliasing is enabled, we need to first render into an anti-aliased render target.
     // If not, we can render directly to a texture that has D3DUSAGE_RENDERTARGET set.
     if (!is_using_texture_to_render(msaa, tgt, multiview)) {
-        if (multiview) {
-            ret |= g::d3d_vr->CreateMultiViewRenderTarget(w, h, fmt, msaa, 0, false, msaa_surface, nullptr, 2);
-        } else {
-            g::d3d_dev->CreateRenderTarget(w, h, fmt, msaa, 0, false, msaa_surface, nullptr);
+        const PoolKey key = { PooledKind::RenderTarget, tgt, w, h, fmt, msaa, multiview };
+        if (*msaa_surface = find_pooled<IDirect3DSurface9>(key); !*msaa_surface) {
+            if (multiview) {
+                ret |= g::d3d_vr->CreateMultiViewRenderTarget(w, h, fmt, msaa, 0, false, msaa_surface, nullptr, 2);
+            } else {
+                ret |= g::d3d_dev->CreateRenderTarget(w, h, fmt, msaa, 0, false, msaa_surface, nullptr);
+            }
+            if (SUCCEEDED(ret)) {
+                add_pooled(key, *msaa_surface);
+            }
+        }
+    }
+    if (*shared_handle == nullptr) {
+        // Textures shared with D3D11 belong to the render context that created them
+        const PoolKey key = { PooledKind::Texture, tgt, w, h, fmt, D3DMULTISAMPLE_NONE, false };
+        if (*target_texture = find_pooled<IDirect3DTexture9>(key); !*target_texture) {
+            ret |= g::d3d_dev->CreateTexture(w, h, 1, D3DUSAGE_RENDERTARGET, fmt, D3DPOOL_DEFAULT, target_texture, nullptr);
+            if (SUCCEEDED(ret)) {
+                add_pooled(key, *target_texture);
+            }
         }
+    } else {
+        ret |= g::d3d_dev->CreateTexture(w, h, 1, D3DUSAGE_RENDERTARGET, fmt, D3DPOOL_DEFAULT, target_texture, shared_handle);
     }
-    ret |= g::d3d_dev->CreateTexture(w, h, 1, D3DUSAGE_RENDERTARGET, fmt, D3DPOOL_DEFAULT, target_texture, *shared_handle == nullptr ? nullptr : shared_handle);
     if (ret != D3D_OK || *shared_handle == INVALID_HANDLE_VALUE) {
         dbg("D3D initialization failed: CreateRenderTarget");
         return false;
@@ -97,21 +175,64 @@ bool create_render_target(
                 create_depth_result = g::d3d_dev->CreateDepthStencilSurface(w, h, wantedFormats[i], msaa, 0, true, depth_stencil_surface, nullptr);
             }
             if (SUCCEEDED(create_depth_result)) {
+                add_pooled({ PooledKind::DepthStencil, tgt, w, h, wantedFormats[i], msaa, multiview }, *depth_stencil_surface);
                 break;
             }
         }
         depth_stencil_format = wantedFormats[i];
         dbg(std::format("Using {} as depthstencil format", (int)depth_stencil_format));
     } else {
-        if (multiview) {
-            ret |= g::d3d_vr->CreateMultiViewDepthStencilSurface(w, h, depth_stencil_format, msaa, 0, true, depth_stencil_surface, nullptr, 2);
-        } else {
-            ret |= g::d3d_dev->CreateDepthStencilSurface(w, h, depth_stencil_format, msaa, 0, true, depth_stencil_surface, nullptr);
-        }
-        if (FAILED(ret)) {
-            dbg("D3D initialization failed: CreateRenderTarget");
-            return false;
+        const PoolKey key = { PooledKind::DepthStencil, tgt, w, h, depth_stencil_format, msaa, multiview };
+        if (*depth_stencil_surface = find_pooled<IDirect3DSurface9>(key); !*depth_stencil_surface) {
+            if (multiview) {
+                ret |= g::d3d_vr->CreateMultiViewDepthStencilSurface(w, h, depth_stencil_format, msaa, 0, true, depth_stencil_surface, nullptr, 2);
+            } else {
+                ret |= g::d3d_dev->CreateDepthStencilSurface(w, h, depth_stencil_format, msaa, 0, true, depth_stencil_surface, nullptr);
+            }
+            if (FAILED(ret)) {
+                dbg("D3D initialization failed: CreateRenderTarget");
+                return false;
+            }
+            add_pooled(key, *depth_stencil_surface);
         }
     }
     return true;
 }
+
+void release_render_target(IUnknown* resource)
+{
+    auto it = std::find_if(render_target_pool.begin(), render_target_pool.end(), [&](const PoolEntry& entry) { return entry.resource == resource; });
+    if (it == render_target_pool.end()) {
+        resource->Release();
+        return;
+    }
+
+    if (--it->users == 0) {
+        it->resource->Release();
+        render_target_pool.erase(it);
+    }
+}
+
+uint64_t render_target_share(IUnknown* resource, uint64_t size)
+{
+    for (const auto& entry : render_target_pool) {
+        if (entry.resource == resource) {
+            return entry.size / entry.users;
+        }
+    }
+    return size;
+}
+
+RenderTargetPoolStats render_target_pool_stats()
+{
+    RenderTargetPoolStats stats = {};
+    for (const auto& entry : render_target_pool) {
+        if (entry.users > 1) {
+            stats.pooled_bytes += entry.size;
+            stats.saved_bytes += entry.size * (entry.users - 1);
+        } else {
+            stats.unique_bytes += entry.size;
+        }
+    }
+    return stats;
+}
@@ -35,3 +35,22 @@ bool create_render_target(
     bool multiview);
 
 bool is_using_texture_to_render(D3DMULTISAMPLE_TYPE msaa, RenderTarget t, bool multiview);
+
+// Releases a surface or texture created with create_render_target. The render contexts share the surfaces
+// with matching descriptors, and a shared surface is released when the last render context using it is released.
+void release_render_target(IUnknown* resource);
+
+// Returns the part of the resource's memory charged to each render context using it: `size` if the resource
+// isn't shared, otherwise the pooled size divided between the users.
+uint64_t render_target_share(IUnknown* resource, uint64_t size);
+
+struct RenderTargetPoolStats {
+    // Surfaces used by more than one render context
+    uint64_t pooled_bytes;
+    // Surfaces used by a single render context
+    uint64_t unique_bytes;
+    // Memory the render contexts would use on top of the above without sharing
+    uint64_t saved_bytes;
+};
+
+RenderTargetPoolStats render_target_pool_stats();
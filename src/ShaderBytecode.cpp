@@ -0,0 +1,221 @@
+#include "ShaderBytecode.hpp"
+
+#include <algorithm>
+
+namespace dxso {
+    // Opcodes and register types from d3d9types.h, repeated here to not depend on the D3D headers
+    enum Opcode : uint32_t {
+        M4x4 = 20,
+        M4x3 = 21,
+        M3x4 = 22,
+        M3x3 = 23,
+        M3x2 = 24,
+        Call = 25,
+        CallNZ = 26,
+        Loop = 27,
+        Label = 30,
+        Dcl = 31,
+        Rep = 38,
+        If = 40,
+        IfC = 41,
+        BreakC = 45,
+        DefB = 47,
+        DefI = 48,
+        Def = 81,
+        BreakP = 96,
+        Phase = 0xFFFD,
+        Comment = 0xFFFE,
+        End = 0xFFFF,
+    };
+
+    enum RegisterType : uint32_t {
+        Const = 2,
+        Const2 = 11,
+        Const3 = 12,
+        Const4 = 13,
+    };
+
+    constexpr uint32_t end_token = 0x0000FFFF;
+    constexpr uint32_t relative_addressing_bit = 1 << 13;
+
+    // Shader model 1.x doesn't encode the instruction length in the instruction token,
+    // so the number of parameter tokens has to be known for each opcode
+    static std::optional<uint32_t> sm1_parameter_count(uint32_t opcode)
+    {
+        switch (opcode) {
+            case 0: return 0; // nop
+            case 1: return 2; // mov
+            case 2: return 3; // add
+            case 3: return 3; // sub
+            case 4: return 4; // mad
+            case 5: return 3; // mul
+            case 6: return 2; // rcp
+            case 7: return 2; // rsq
+            case 8: return 3; // dp3
+            case 9: return 3; // dp4
+            case 10: return 3; // min
+            case 11: return 3; // max
+            case 12: return 3; // slt
+            case 13: return 3; // sge
+            case 14: return 2; // exp
+            case 15: return 2; // log
+            case 16: return 2; // lit
+            case 17: return 3; // dst
+            case 18: return 4; // lrp
+            case 19: return 2; // frc
+            case M4x4: return 3;
+            case M4x3: return 3;
+            case M3x4: return 3;
+            case M3x3: return 3;
+            case M3x2: return 3;
+            case Dcl: return 2;
+            case 78: return 2; // expp
+            case 79: return 2; // logp
+            case Def: return 5;
+            default: return std::nullopt;
+        }
+    }
+
+    // Number of consecutive registers read by the matrix source of the m*x* instructions
+    static uint32_t matrix_rows(uint32_t opcode)
+    {
+        switch (opcode) {
+            case M4x4: return 4;
+            case M4x3: return 3;
+            case M3x4: return 4;
+            case M3x3: return 3;
+            case M3x2: return 2;
+            default: return 1;
+        }
+    }
+
+    // The flow control instructions only have source parameters
+    static bool has_destination(uint32_t opcode)
+    {
+        switch (opcode) {
+            case Call:
+            case CallNZ:
+            case Loop:
+            case Label:
+            case Rep:
+            case If:
+            case IfC:
+            case BreakC:
+            case BreakP: return false;
+            default: return true;
+        }
+    }
+
+    static std::optional<uint32_t> float_constant_register(uint32_t token)
+    {
+        const auto type = ((token >> 28) & 0x7) | ((token >> 8) & 0x18);
+        const auto number = token & 0x7FF;
+        switch (type) {
+            case Const: return number;
+            case Const2: return number + 2048;
+            case Const3: return number + 4096;
+            case Const4: return number + 6144;
+            default: return std::nullopt;
+        }
+    }
+
+    std::optional<BytecodeInfo> analyze(std::span<const uint32_t> bytecode)
+    {
+        if (bytecode.empty()) {
+            return std::nullopt;
+        }
+
+        BytecodeInfo info = {};
+        const auto version = bytecode[0];
+        const auto type = version >> 16;
+        if (type != 0xFFFE && type != 0xFFFF) {
+            return std::nullopt;
+        }
+        info.is_vertex_shader = type == 0xFFFE;
+        info.major_version = (version >> 8) & 0xFF;
+        info.minor_version = version & 0xFF;
+        if (info.major_version < 1 || info.major_version > 3) {
+            return std::nullopt;
+        }
+
+        const auto max_constants = info.major_version < 2 ? 96u : 256u;
+        const auto size = bytecode.size();
+        size_t i = 1;
+        while (true) {
+            if (i >= size) {
+                // Ran out of data before the end token
+                return std::nullopt;
+            }
+
+            const auto token = bytecode[i];
+            if (token == end_token) {
+                info.length = i + 1;
+                break;
+            }
+
+            const auto opcode = token & 0xFFFF;
+            if (opcode == Comment) {
+                const auto comment_length = (token >> 16) & 0x7FFF;
+                i += 1 + comment_length;
+                continue;
+            }
+
+            size_t length;
+            if (info.major_version >= 2) {
+                length = (token >> 24) & 0xF;
+            } else if (const auto count = sm1_parameter_count(opcode); count) {
+                length = count.value();
+            } else {
+                return std::nullopt;
+            }
+
+            const auto params = i + 1;
+            const auto next = params + length;
+            if (next > size) {
+                return std::nullopt;
+            }
+
+            // The declarations don't read any registers, and the definitions have literal values after the
+            // destination register. Neither of these may be parsed as parameter tokens.
+            if (opcode != Dcl && opcode != Def && opcode != DefI && opcode != DefB && opcode != Phase) {
+                const uint32_t first_source = has_destination(opcode) ? 1 : 0;
+                uint32_t param_index = 0;
+                for (auto p = params; p < next; ++p, ++param_index) {
+                    const auto param = bytecode[p];
+                    const auto is_source = param_index >= first_source;
+                    const auto relative = (param & relative_addressing_bit) != 0;
+
+                    if (const auto reg = float_constant_register(param); is_source && reg) {
+                        // The second source of the matrix instructions reads several consecutive registers
+                        const auto rows = param_index == 2 ? matrix_rows(opcode) : 1;
+                        for (uint32_t r = 0; r < rows; ++r) {
+                            info.constant_registers.push_back(reg.value() + r);
+                        }
+                        if (relative) {
+                            info.relative_addressing = true;
+                        }
+                    }
+
+                    if (relative && info.major_version >= 2) {
+                        // Skip the relative addressing token
+                        ++p;
+                    }
+                }
+            }
+
+            i = next;
+        }
+
+        auto& regs = info.constant_registers;
+        std::sort(regs.begin(), regs.end());
+        regs.erase(std::unique(regs.begin(), regs.end()), regs.end());
+
+        if (info.relative_addressing) {
+            info.constant_register_count = std::max(max_constants, regs.empty() ? 0 : regs.back() + 1);
+        } else {
+            info.constant_register_count = regs.empty() ? 0 : regs.back() + 1;
+        }
+
+        return info;
+    }
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+// Parser for D3D9 shader model 1.1 - 3.0 bytecode
+// Only depends on the standard library, so it can be used outside of the game too.
+namespace dxso {
+    struct BytecodeInfo {
+        uint32_t major_version;
+        uint32_t minor_version;
+        bool is_vertex_shader;
+
+        // Length of the bytecode in DWORDs, including the end token
+        size_t length;
+
+        // Float constant registers read by the shader, sorted and without duplicates
+        std::vector<uint32_t> constant_registers;
+
+        // One past the highest float constant register read by the shader.
+        // If the shader uses relative addressing, this is the highest register
+        // available for the shader model, as any register may be read.
+        uint32_t constant_register_count;
+
+        // True if float constants are read with relative addressing (c[a0.x + n])
+        bool relative_addressing;
+    };
+
+    // Analyzes the bytecode, reading at most `bytecode.size()` DWORDs.
+    // Returns std::nullopt for malformed or truncated bytecode.
+    std::optional<BytecodeInfo> analyze(std::span<const uint32_t> bytecode);
+}
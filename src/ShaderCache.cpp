@@ -0,0 +1,362 @@
+#include "ShaderCache.hpp"
+#include "Globals.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+namespace shader_cache {
+    // Bump this if the file layout or the meaning of the recipes change
+    constexpr uint32_t format_version = 1;
+    constexpr uint32_t magic = 0x43565252; // "RRVC"
+    constexpr uint32_t registers_magic = 0x4c565252; // "RRVL"
+    // Upper limit for the size of the cache directory. The oldest entries are removed first when it's exceeded.
+    constexpr uint64_t max_cache_size = 256ull * 1024 * 1024;
+    // Vertex shaders have at most 256 float constant registers
+    constexpr uint32_t max_registers = 256;
+
+    enum EntryStatus : uint32_t {
+        Ok = 0,
+        Failed = 1,
+    };
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t build_id;
+        uint64_t recipe_hash;
+        uint32_t status;
+        uint32_t word_count;
+    };
+
+    // Header of a learned registers file. The registers don't depend on the DXVK and patcher builds.
+    struct RegistersHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t count;
+    };
+
+    static std::filesystem::path cache_dir;
+    static uint64_t build_id;
+    static bool enabled;
+    static Stats cache_stats;
+
+    static uint64_t fnv1a(const void* data, size_t len, uint64_t h = 0xcbf29ce484222325ull)
+    {
+        const auto p = reinterpret_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < len; ++i) {
+            h = (h ^ p[i]) * 0x100000001b3ull;
+        }
+        return h;
+    }
+
+    static uint64_t fnv1a(const std::string& s, uint64_t h = 0xcbf29ce484222325ull)
+    {
+        return fnv1a(s.data(), s.size(), h);
+    }
+
+    static uint64_t hash_file_identity(const std::filesystem::path& path, uint64_t h)
+    {
+        std::error_code ec;
+        const uint64_t size = std::filesystem::file_size(path, ec);
+        if (ec) {
+            return h;
+        }
+        const int64_t mtime = std::filesystem::last_write_time(path, ec).time_since_epoch().count();
+        h = fnv1a(&size, sizeof(size), h);
+        return fnv1a(&mtime, sizeof(mtime), h);
+    }
+
+    static std::string file_name(const std::string& hash)
+    {
+        std::string name;
+        for (const auto c : hash) {
+            if (std::isalnum(static_cast<unsigned char>(c))) {
+                name.push_back(c);
+            }
+        }
+        return name;
+    }
+
+    static std::filesystem::path entry_path(const std::string& hash, const std::string& recipe)
+    {
+        return cache_dir / std::format("{}-{:016x}.spv", file_name(hash), fnv1a(recipe));
+    }
+
+    static std::filesystem::path registers_path(const std::string& hash)
+    {
+        return cache_dir / std::format("{}.reg", file_name(hash));
+    }
+
+    // Writes `size` bytes of `data` after `header` to `path` through a temporary file, so that a partially written file is never read
+    template <typename H>
+    static bool write_file(const std::filesystem::path& path, const H& header, const void* data, size_t size)
+    {
+        auto tmp = path;
+        tmp += std::format(".{}.tmp", GetCurrentThreadId());
+        {
+            std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+            if (!f.good()) {
+                return false;
+            }
+            f.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            f.write(reinterpret_cast<const char*>(data), size);
+            if (!f.good()) {
+                f.close();
+                std::error_code ec;
+                std::filesystem::remove(tmp, ec);
+                return false;
+            }
+        }
+
+        std::error_code ec;
+        std::filesystem::rename(tmp, path, ec);
+        if (ec) {
+            std::filesystem::remove(tmp, ec);
+            return false;
+        }
+        return true;
+    }
+
+    static void write_entry(const std::string& hash, const std::string& recipe, EntryStatus status, std::span<const uint32_t> spirv)
+    {
+        if (!enabled || hash.empty()) {
+            return;
+        }
+
+        const Header header {
+            .magic = magic,
+            .version = format_version,
+            .build_id = build_id,
+            .recipe_hash = fnv1a(recipe),
+            .status = status,
+            .word_count = static_cast<uint32_t>(spirv.size()),
+        };
+
+        if (write_file(entry_path(hash, recipe), header, spirv.data(), spirv.size_bytes())) {
+            cache_stats.stores++;
+        }
+    }
+
+    // True if the entry was written by this build of the plugin, DXVK and the patcher
+    static bool is_current_entry(const std::filesystem::path& path)
+    {
+        Header header;
+        std::ifstream f(path, std::ios::binary);
+        if (!f.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+            return false;
+        }
+        return header.magic == magic && header.version == format_version && header.build_id == build_id;
+    }
+
+    static bool is_registers_file(const std::filesystem::path& path)
+    {
+        RegistersHeader header;
+        std::ifstream f(path, std::ios::binary);
+        if (!f.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+            return false;
+        }
+        return header.magic == registers_magic && header.version == format_version;
+    }
+
+    // Removes the entries of other builds and temporary files left behind by a crash.
+    // Learned registers files are kept over builds.
+    // If the rest are larger than max_cache_size, the oldest ones are removed as well.
+    static void prune()
+    {
+        struct File {
+            std::filesystem::path path;
+            uint64_t size;
+            std::filesystem::file_time_type mtime;
+        };
+        std::vector<File> entries;
+        std::vector<std::filesystem::path> stale;
+        uint64_t total_size = 0;
+
+        std::error_code ec;
+        for (const auto& file : std::filesystem::directory_iterator(cache_dir, ec)) {
+            if (!file.is_regular_file(ec)) {
+                continue;
+            }
+            const auto ext = file.path().extension();
+            const auto current = ext == ".spv" ? is_current_entry(file.path()) : ext == ".reg" && is_registers_file(file.path());
+            if (!current) {
+                stale.push_back(file.path());
+                continue;
+            }
+            entries.push_back({ file.path(), file.file_size(ec), file.last_write_time(ec) });
+            total_size += entries.back().size;
+        }
+
+        if (total_size > max_cache_size) {
+            std::sort(entries.begin(), entries.end(), [](const File& a, const File& b) { return a.mtime < b.mtime; });
+            for (const auto& entry : entries) {
+                if (total_size <= max_cache_size) {
+                    break;
+                }
+                stale.push_back(entry.path);
+                total_size -= entry.size;
+            }
+        }
+
+        size_t removed = 0;
+        for (const auto& path : stale) {
+            if (std::filesystem::remove(path, ec)) {
+                removed++;
+            }
+        }
+        if (removed > 0) {
+            dbg(std::format("Removed {} stale shader cache entries, {} MB left", removed, total_size / (1024 * 1024)));
+        }
+    }
+
+    Entry::~Entry()
+    {
+        reset();
+    }
+
+    void Entry::reset()
+    {
+        if (view) {
+            UnmapViewOfFile(view);
+        }
+        if (mapping) {
+            CloseHandle(mapping);
+        }
+        if (file != INVALID_HANDLE_VALUE) {
+            CloseHandle(file);
+        }
+        view = nullptr;
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+        code = {};
+    }
+
+    void init()
+    {
+        cache_dir = std::filesystem::current_path() / "Plugins" / "openRBRVR" / "shadercache";
+
+        std::error_code ec;
+        std::filesystem::create_directories(cache_dir, ec);
+        if (ec) {
+            dbg(std::format("Could not create shader cache directory: {}", ec.message()));
+            enabled = false;
+            return;
+        }
+
+        auto h = fnv1a(&format_version, sizeof(format_version));
+        h = fnv1a(g::dxvk_version, h);
+        h = hash_file_identity("d3d9.dll", h);
+        h = hash_file_identity(std::filesystem::path("Plugins") / "openRBRVR" / "multiviewpatcher.dll", h);
+        build_id = h;
+        enabled = true;
+
+        prune();
+    }
+
+    Status lookup(const std::string& hash, const std::string& recipe, Entry& entry)
+    {
+        entry.reset();
+        if (!enabled || hash.empty()) {
+            return Status::Miss;
+        }
+
+        const auto path = entry_path(hash, recipe);
+        entry.file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (entry.file == INVALID_HANDLE_VALUE) {
+            cache_stats.misses++;
+            return Status::Miss;
+        }
+
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(entry.file, &size) || size.QuadPart < static_cast<LONGLONG>(sizeof(Header))) {
+            entry.reset();
+            cache_stats.misses++;
+            return Status::Miss;
+        }
+
+        entry.mapping = CreateFileMappingW(entry.file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        entry.view = entry.mapping ? MapViewOfFile(entry.mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+        if (!entry.view) {
+            entry.reset();
+            cache_stats.misses++;
+            return Status::Miss;
+        }
+
+        // Entries from other builds or truncated files are treated as misses and overwritten later on
+        const auto header = reinterpret_cast<const Header*>(entry.view);
+        const auto expected_size = sizeof(Header) + static_cast<uint64_t>(header->word_count) * sizeof(uint32_t);
+        if (header->magic != magic
+            || header->version != format_version
+            || header->build_id != build_id
+            || header->recipe_hash != fnv1a(recipe)
+            || static_cast<uint64_t>(size.QuadPart) != expected_size) {
+            entry.reset();
+            cache_stats.misses++;
+            return Status::Miss;
+        }
+
+        if (header->status == Failed) {
+            entry.reset();
+            cache_stats.hits++;
+            return Status::KnownFailure;
+        }
+
+        entry.code = { reinterpret_cast<const uint32_t*>(header + 1), header->word_count };
+        cache_stats.hits++;
+        return Status::Hit;
+    }
+
+    void store(const std::string& hash, const std::string& recipe, std::span<const uint32_t> spirv)
+    {
+        write_entry(hash, recipe, Ok, spirv);
+    }
+
+    void store_failure(const std::string& hash, const std::string& recipe)
+    {
+        write_entry(hash, recipe, Failed, {});
+    }
+
+    std::vector<uint32_t> lookup_registers(const std::string& hash)
+    {
+        if (!enabled || hash.empty()) {
+            return {};
+        }
+
+        std::ifstream f(registers_path(hash), std::ios::binary);
+        RegistersHeader header;
+        if (!f.read(reinterpret_cast<char*>(&header), sizeof(header))
+            || header.magic != registers_magic
+            || header.version != format_version
+            || header.count > max_registers) {
+            return {};
+        }
+
+        std::vector<uint32_t> registers(header.count);
+        if (!f.read(reinterpret_cast<char*>(registers.data()), registers.size() * sizeof(uint32_t))) {
+            return {};
+        }
+        return registers;
+    }
+
+    void store_registers(const std::string& hash, std::span<const uint32_t> registers)
+    {
+        if (!enabled || hash.empty() || registers.size() > max_registers) {
+            return;
+        }
+
+        const RegistersHeader header {
+            .magic = registers_magic,
+            .version = format_version,
+            .count = static_cast<uint32_t>(registers.size()),
+        };
+        write_file(registers_path(hash), header, registers.data(), registers.size_bytes());
+    }
+
+    const Stats& stats()
+    {
+        return cache_stats;
+    }
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "Util.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+// On-disk cache of multiview patched SPIR-V
+//
+// Entries are keyed by the DXVK shader hash and a recipe string that describes
+// every patch applied to the shader since it was created. The recipe needs to
+// contain all the parameters given to the patcher, as the same shader may be
+// patched differently depending on which registers the game uses.
+//
+// Each entry records the identity of the DXVK and multiviewpatcher builds that
+// produced it. If either of those changes, the entry is ignored and rewritten.
+// Entries of other builds are removed when the cache is initialized, and the
+// size of the cache is capped by removing the oldest entries.
+//
+// The registers patched to each BTB shader are stored in their own small files
+// next to the entries, so that the shaders can be patched already during the
+// stage load next time.
+namespace shader_cache {
+    enum class Status {
+        Miss,
+        Hit,
+        KnownFailure,
+    };
+
+    // Read-only memory mapping of a cached SPIR-V binary
+    class Entry {
+    public:
+        Entry() = default;
+        Entry(const Entry&) = delete;
+        Entry& operator=(const Entry&) = delete;
+        ~Entry();
+
+        std::span<const uint32_t> spirv() const { return code; }
+
+    private:
+        friend Status lookup(const std::string& hash, const std::string& recipe, Entry& entry);
+        void reset();
+
+        HANDLE file = INVALID_HANDLE_VALUE;
+        HANDLE mapping = nullptr;
+        const void* view = nullptr;
+        std::span<const uint32_t> code;
+    };
+
+    struct Stats {
+        std::atomic<int> hits;
+        std::atomic<int> misses;
+        std::atomic<int> stores;
+    };
+
+    // Resolves the cache directory and the identity of the DXVK and patcher builds in use, and prunes the stale entries.
+    // Must be called before any other function, and before any worker threads are started.
+    void init();
+
+    Status lookup(const std::string& hash, const std::string& recipe, Entry& entry);
+
+    // Storing entries is safe to do from any thread
+    void store(const std::string& hash, const std::string& recipe, std::span<const uint32_t> spirv);
+    void store_failure(const std::string& hash, const std::string& recipe);
+
+    // Learned BTB shader registers, in the order they were patched. Empty if none are stored.
+    std::vector<uint32_t> lookup_registers(const std::string& hash);
+    void store_registers(const std::string& hash, std::span<const uint32_t> registers);
+
+    const Stats& stats();
+}
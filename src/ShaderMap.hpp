@@ -0,0 +1,160 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct IDirect3DVertexShader9;
+
+enum class ShaderClass : uint8_t {
+    Base,
+    External,
+    BTB,
+};
+
+// Information about a vertex shader created through the hooked CreateVertexShader
+struct ShaderInfo {
+    // Shader to bind instead of the original when multiview rendering is enabled.
+    // Points to the shader itself for multiview shaders, and for shaders whose patching failed.
+    IDirect3DVertexShader9* multiview;
+    ShaderClass cls;
+    // True if the key is the multiview copy of a shader
+    bool is_multiview;
+    // One past the highest float constant register the shader reads
+    uint32_t constant_register_count;
+    // False if the bytecode couldn't be analyzed or the shader uses relative addressing for the constants.
+    // In this case the shader may read any register.
+    bool constant_usage_known;
+    // Index of the learned constant table of a BTB shader. Shared by the original and the multiview copy.
+    uint32_t constant_table = 0;
+};
+
+// Open addressing hash map from vertex shader pointers to ShaderInfo
+// Shaders are bound and looked up many times per draw call, so the lookup
+// needs to be constant time regardless of how many shaders a BTB stage has.
+class ShaderMap {
+    struct Slot {
+        IDirect3DVertexShader9* key;
+        ShaderInfo value;
+    };
+
+    std::vector<Slot> slots;
+    size_t count = 0;
+    uint32_t bits = 0;
+
+    size_t home(const IDirect3DVertexShader9* key) const
+    {
+        // Fibonacci hashing. Drop the low bits as allocations are aligned anyway, and fold the high bits in
+        // first: heap addresses of similar sized objects are close to each other and would cluster otherwise.
+        auto v = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(key) >> 3);
+        v ^= v >> 16;
+        return static_cast<uint32_t>(v * 2654435769u) >> (32 - bits);
+    }
+
+    void grow()
+    {
+        auto old = std::move(slots);
+        bits = bits ? bits + 1 : 6;
+        slots.assign(size_t(1) << bits, Slot {});
+        count = 0;
+        for (const auto& slot : old) {
+            if (slot.key) {
+                insert(slot.key, slot.value);
+            }
+        }
+    }
+
+public:
+    const ShaderInfo* find(const IDirect3DVertexShader9* key) const
+    {
+        if (!key || count == 0) [[unlikely]] {
+            return nullptr;
+        }
+
+        const auto mask = slots.size() - 1;
+        for (auto i = home(key);; i = (i + 1) & mask) {
+            if (slots[i].key == key) {
+                return &slots[i].value;
+            }
+            if (!slots[i].key) {
+                return nullptr;
+            }
+        }
+    }
+
+    // Inserts a new shader or replaces the information of an existing one
+    void insert(IDirect3DVertexShader9* key, const ShaderInfo& value)
+    {
+        if (!key) {
+            return;
+        }
+
+        // Keep the load factor at or below 0.5 so the probe sequences stay short
+        if ((count + 1) * 2 > slots.size()) {
+            grow();
+        }
+
+        const auto mask = slots.size() - 1;
+        for (auto i = home(key);; i = (i + 1) & mask) {
+            if (slots[i].key == key) {
+                slots[i].value = value;
+                return;
+            }
+            if (!slots[i].key) {
+                slots[i] = { key, value };
+                count++;
+                return;
+            }
+        }
+    }
+
+    void erase(const IDirect3DVertexShader9* key)
+    {
+        if (!key || count == 0) {
+            return;
+        }
+
+        const auto mask = slots.size() - 1;
+        auto i = home(key);
+        while (slots[i].key != key) {
+            if (!slots[i].key) {
+                return;
+            }
+            i = (i + 1) & mask;
+        }
+
+        // Backward shift deletion, keeps the table free of tombstones
+        slots[i].key = nullptr;
+        count--;
+        for (auto j = (i + 1) & mask; slots[j].key; j = (j + 1) & mask) {
+            const auto k = home(slots[j].key);
+            const auto in_place = (i <= j) ? (i < k && k <= j) : (i < k || k <= j);
+            if (!in_place) {
+                slots[i] = slots[j];
+                slots[j].key = nullptr;
+                i = j;
+            }
+        }
+    }
+
+    size_t size() const { return count; }
+};
+
+// Makes `shader` bind itself instead of its multiview copy, for when the copy couldn't be created or patched.
+// The entry of the copy is removed, unless the copy is `shader` itself because it couldn't be created.
+inline void fall_back_to_original_shader(ShaderMap& shaders, IDirect3DVertexShader9* shader, IDirect3DVertexShader9* multiview)
+{
+    const auto found = shaders.find(shader);
+    if (!found) {
+        return;
+    }
+
+    // Copied before erasing, which moves the other entries around
+    auto info = *found;
+    info.multiview = shader;
+    info.is_multiview = false;
+    if (multiview != shader) {
+        shaders.erase(multiview);
+    }
+    shaders.insert(shader, info);
+}
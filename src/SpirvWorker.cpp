@@ -0,0 +1,97 @@
+#include "SpirvWorker.hpp"
+#include "ShaderCache.hpp"
+
+SpirvWorker::SpirvWorker(size_t thread_count)
+{
+    for (size_t i = 0; i < thread_count; ++i) {
+        threads.emplace_back([this] { run(); });
+    }
+}
+
+SpirvWorker::~SpirvWorker()
+{
+    {
+        std::lock_guard lock(mtx);
+        quit = true;
+    }
+    cv.notify_all();
+    for (auto& thread : threads) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+}
+
+void SpirvWorker::submit(Job&& job)
+{
+    {
+        std::lock_guard lock(mtx);
+        jobs.push_back(std::move(job));
+        pending++;
+    }
+    cv.notify_one();
+}
+
+std::optional<SpirvWorker::Result> SpirvWorker::poll()
+{
+    std::lock_guard lock(mtx);
+    if (results.empty()) {
+        return std::nullopt;
+    }
+
+    auto result = std::move(results.front());
+    results.pop_front();
+    pending--;
+    return result;
+}
+
+std::optional<SpirvWorker::Result> SpirvWorker::wait()
+{
+    std::unique_lock lock(mtx);
+    result_cv.wait(lock, [this] { return pending == 0 || !results.empty(); });
+    if (results.empty()) {
+        return std::nullopt;
+    }
+
+    auto result = std::move(results.front());
+    results.pop_front();
+    pending--;
+    return result;
+}
+
+size_t SpirvWorker::in_flight() const
+{
+    std::lock_guard lock(mtx);
+    return pending;
+}
+
+void SpirvWorker::run()
+{
+    while (true) {
+        Job job;
+        {
+            std::unique_lock lock(mtx);
+            cv.wait(lock, [this] { return quit || !jobs.empty(); });
+            if (quit) {
+                return;
+            }
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        const auto ok = job.transform(job.spirv);
+        const auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+        if (ok) {
+            shader_cache::store(job.hash, job.recipe, job.spirv);
+        } else {
+            shader_cache::store_failure(job.hash, job.recipe);
+        }
+
+        {
+            std::lock_guard lock(mtx);
+            results.push_back({ job.shader, job.generation, std::move(job.spirv), ok, duration });
+        }
+        result_cv.notify_all();
+    }
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct IDirect3DVertexShader9;
+
+// Background workers for SPIR-V patching jobs
+//
+// The SPIR-V code is snapshotted on the render thread and given to the workers,
+// which only transform the code and store the result in the shader cache.
+// The workers never touch the D3D device: the results are polled and applied
+// to the shaders on the render thread. Results may come back in any order.
+class SpirvWorker {
+public:
+    using Transform = std::function<bool(std::vector<uint32_t>&)>;
+
+    struct Job {
+        IDirect3DVertexShader9* shader;
+        // Used by the caller to detect results of shaders that have been released meanwhile
+        uint64_t generation;
+        std::string hash;
+        std::string recipe;
+        std::vector<uint32_t> spirv;
+        Transform transform;
+    };
+
+    struct Result {
+        IDirect3DVertexShader9* shader;
+        uint64_t generation;
+        std::vector<uint32_t> spirv;
+        bool ok;
+        // Time spent transforming the code
+        std::chrono::microseconds duration;
+    };
+
+    explicit SpirvWorker(size_t thread_count = 1);
+    ~SpirvWorker();
+    SpirvWorker(const SpirvWorker&) = delete;
+    SpirvWorker& operator=(const SpirvWorker&) = delete;
+
+    void submit(Job&& job);
+
+    // Returns a finished result, if there is one
+    std::optional<Result> poll();
+
+    // Blocks until a result is finished. Returns std::nullopt if there are no jobs in flight.
+    std::optional<Result> wait();
+
+    // Number of jobs submitted but not yet polled
+    size_t in_flight() const;
+
+private:
+    void run();
+
+    mutable std::mutex mtx;
+    std::condition_variable cv;
+    std::condition_variable result_cv;
+    std::deque<Job> jobs;
+    std::deque<Result> results;
+    size_t pending = 0;
+    bool quit = false;
+    std::vector<std::thread> threads;
+};
@@ -16,6 +16,35 @@ void write_data(uintptr_t address, uint8_t* values, size_t byte_count)
     }
 }
 
+std::optional<M4> perspective_inverse(const D3DMATRIX& m)
+{
+    const auto a = m._11;
+    const auto b = m._22;
+    const auto c = m._31;
+    const auto d = m._32;
+    const auto e = m._33;
+    const auto s = m._34;
+    const auto f = m._43;
+
+    const auto is_perspective = a != 0.0f && b != 0.0f && s != 0.0f && f != 0.0f
+        && m._12 == 0.0f && m._13 == 0.0f && m._14 == 0.0f
+        && m._21 == 0.0f && m._23 == 0.0f && m._24 == 0.0f
+        && m._41 == 0.0f && m._42 == 0.0f && m._44 == 0.0f;
+    if (!is_perspective) {
+        return std::nullopt;
+    }
+
+    D3DMATRIX inv = {};
+    inv._11 = 1.0f / a;
+    inv._22 = 1.0f / b;
+    inv._34 = 1.0f / f;
+    inv._41 = -c / (a * s);
+    inv._42 = -d / (b * s);
+    inv._43 = 1.0f / s;
+    inv._44 = -e / (f * s);
+    return m4_from_d3d(inv);
+}
+
 constexpr std::optional<std::string> d3drs_to_string(uint32_t v)
 {
     switch (v) {
@@ -5,6 +5,7 @@
 #include <windows.h>
 #include <debugapi.h>
 #include <format>
+#include <optional>
 #include <string>
 #include <d3d9.h>
 
@@ -65,6 +66,14 @@ constexpr void m4_to_3dof(M4& m)
     m[3][2] = 0;
 }
 
+// Closed form inverse of a D3D perspective projection matrix
+// Returns std::nullopt if the matrix is not of the form
+//   a 0 0 0
+//   0 b 0 0
+//   c d e s
+//   0 0 f 0
+std::optional<M4> perspective_inverse(const D3DMATRIX& m);
+
 void write_data(uintptr_t address, uint8_t* values, size_t byte_count);
 
 inline void write_byte(uintptr_t address, uint8_t value)
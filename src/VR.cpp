@@ -6,7 +6,10 @@
 #include "Util.hpp"
 #include "Vertex.hpp"
 
+#include <algorithm>
+#include <array>
 #include <format>
+#include <gtx/matrix_decompose.hpp>
 
 // Compliation unit global variables
 namespace g {
@@ -15,6 +18,11 @@ namespace g {
     static constexpr D3DMATRIX identity_matrix = d3d_from_m4(glm::identity<glm::mat4x4>());
     static IDirect3DVertexBuffer9* quad_vertex_buf[2];
     static IDirect3DVertexBuffer9* overlay_border_quad;
+
+    // States for drawing the textured quads, with and without depth testing
+    static IDirect3DStateBlock9* quad_state_block[2];
+    // Captures the states changed by quad_state_block, to restore them after drawing
+    static IDirect3DStateBlock9* quad_restore_state_block;
 }
 
 bool VRInterface::is_using_quad_view_rendering() const
@@ -22,10 +30,83 @@ bool VRInterface::is_using_quad_view_rendering() const
     return get_runtime_type() == OPENXR && g::cfg.quad_view_rendering;
 }
 
+void VRInterface::update_frame_matrices(const M4& horizon_lock)
+{
+    // The products are calculated in the same order as they were in the hooks, so the results are identical
+    for (size_t i = 0; i < 4; ++i) {
+        const auto eye_pose = eye_pos[i] * hmd_pose[i] * g::flip_z_matrix;
+        frame_matrices.view[i] = eye_pose * horizon_lock;
+        frame_matrices.view_without_horizon_lock[i] = eye_pose;
+        frame_matrices.view_projection[i] = projection[i] * eye_pos[i] * hmd_pose[i] * g::flip_z_matrix * horizon_lock;
+    }
+
+    // Always use left eye for the pose, as some effects (like the "darkness" effect in Mitterbach Tarmac night version)
+    // may render differently in each eye, especially if the object is far away, which makes it look awful.
+    // For the fog, the orientation is close enough for both eyes when always rendered with the same eye.
+    glm::vec4 perspective;
+    glm::vec3 scale, translation, skew;
+    glm::quat orientation;
+    glm::decompose(hmd_pose[LeftEye], scale, orientation, translation, skew, perspective);
+    frame_matrices.sky_rotation = glm::mat4_cast(glm::conjugate(orientation));
+}
+
+// Approximate sizes for the VRAM estimate, assuming 4 bytes per sample as all the targets use 32-bit formats
+static uint64_t surface_size(IDirect3DSurface9* surface)
+{
+    D3DSURFACE_DESC desc;
+    if (!surface || surface->GetDesc(&desc) != D3D_OK) {
+        return 0;
+    }
+    return static_cast<uint64_t>(desc.Width) * desc.Height * 4 * std::max<uint64_t>(desc.MultiSampleType, 1);
+}
+
+static uint64_t texture_size(IDirect3DTexture9* texture)
+{
+    D3DSURFACE_DESC desc;
+    if (!texture || texture->GetLevelDesc(0, &desc) != D3D_OK) {
+        return 0;
+    }
+    return static_cast<uint64_t>(desc.Width) * desc.Height * 4;
+}
+
+// Approximate VRAM charged to the context. The textures and surfaces shared with other contexts are divided between them,
+// so the shares change as contexts are created and released.
+static uint64_t render_context_size(const RenderContext& ctx)
+{
+    uint64_t size = ctx.estimated_size;
+    for (int i = 0; i < 6; ++i) {
+        size += render_target_share(ctx.dx_texture[i], texture_size(ctx.dx_texture[i]));
+        size += render_target_share(ctx.dx_surface[i], surface_size(ctx.dx_surface[i]));
+        size += render_target_share(ctx.dx_depth_stencil_surface[i], surface_size(ctx.dx_depth_stencil_surface[i]));
+    }
+    return size;
+}
+
 void VRInterface::set_render_context(const std::string& name)
 {
+    // Render contexts are created when they're first used. The stage's context is set when its ID becomes known
+    // before the stage is loaded, so the creation doesn't happen while driving.
+    if (!render_contexts.contains(name)) {
+        try {
+            create_render_context(g::d3d_dev, name);
+            const auto& ctx = render_contexts[name];
+            dbg(std::format("Created render context {}: {} MB", name, render_context_size(ctx) / (1024 * 1024)));
+            evict_render_contexts(name);
+        } catch (const std::runtime_error& e) {
+            release_render_context(render_contexts[name]);
+            render_contexts.erase(name);
+            if (name == "default") {
+                throw;
+            }
+            dbg(std::format("Could not create render context {}, using default: {}", name, e.what()));
+            set_render_context("default");
+            return;
+        }
+    }
+
     current_render_context = &render_contexts[name];
     current_render_context_name = name;
+    current_render_context->last_used = ++render_context_uses;
 
     // Per-stage setting of multiview rendering
     if (dx::multiview_rendering_enabled() != g::vr->get_current_render_context()->multiview_rendering) {
@@ -34,6 +115,60 @@ void VRInterface::set_render_context(const std::string& name)
     }
 }
 
+void VRInterface::release_render_context(RenderContext& ctx)
+{
+    for (int i = 0; i < 6; ++i) {
+        if (ctx.dx_texture[i]) {
+            release_render_target(ctx.dx_texture[i]);
+        }
+        if (ctx.dx_surface[i]) {
+            release_render_target(ctx.dx_surface[i]);
+        }
+        if (ctx.dx_depth_stencil_surface[i]) {
+            release_render_target(ctx.dx_depth_stencil_surface[i]);
+        }
+        if (i < 4 && ctx.dx_shared_handle[i] != nullptr && ctx.dx_shared_handle[i] != INVALID_HANDLE_VALUE) {
+            CloseHandle(ctx.dx_shared_handle[i]);
+        }
+    }
+    if (ctx.overlay_border) {
+        ctx.overlay_border->Release();
+    }
+    ctx = {};
+}
+
+void VRInterface::evict_render_contexts(const std::string& keep)
+{
+    const auto budget = static_cast<uint64_t>(g::cfg.experimental.render_context_budget_mb) * 1024 * 1024;
+    if (budget == 0) {
+        return;
+    }
+
+    while (true) {
+        uint64_t total = 0;
+        std::optional<std::string> lru;
+        for (const auto& [name, ctx] : render_contexts) {
+            total += render_context_size(ctx);
+
+            // The default context is the fallback for all the stages, and the current one may still be in use by the frame
+            if (name == "default" || name == keep || &ctx == current_render_context) {
+                continue;
+            }
+            if (!lru || ctx.last_used < render_contexts[lru.value()].last_used) {
+                lru = name;
+            }
+        }
+
+        if (total <= budget || !lru) {
+            return;
+        }
+
+        dbg(std::format("Render contexts use {} MB of {} MB, releasing {}", total / (1024 * 1024), budget / (1024 * 1024), lru.value()));
+        release_render_context(render_contexts[lru.value()]);
+        render_contexts.erase(lru.value());
+    }
+}
+
 static bool create_menu_screen_companion_window_buffer(IDirect3DDevice9* dev)
 {
     // clang-format off
@@ -179,6 +314,8 @@ void VRInterface::init_surfaces(IDirect3DDevice9* dev, RenderContext& ctx, uint3
             throw std::runtime_error("Could not create desktop window buffer");
         if (!create_menu_screen_companion_window_buffer(dev))
             throw std::runtime_error("Could not create menu screen desktop window buffer");
+        if (!create_quad_state_blocks(dev))
+            throw std::runtime_error("Could not create state blocks for quad rendering");
 
         quads_created = true;
     }
@@ -202,45 +339,17 @@ void VRInterface::init_surfaces(IDirect3DDevice9* dev, RenderContext& ctx, uint3
         dev->SetRenderTarget(0, orig);
         orig->Release();
     }
+
+    ctx.estimated_size = texture_size(ctx.overlay_border);
 }
 
-static void render_texture(
-    IDirect3DDevice9* dev,
-    const D3DMATRIX* proj,
-    const D3DMATRIX* proj_multiview,
-    const D3DMATRIX* view,
-    const D3DMATRIX* world,
-    IDirect3DTexture9* tex,
-    IDirect3DVertexBuffer9* vbuf)
+static bool record_quad_state_block(IDirect3DDevice9* dev, bool z_enable, IDirect3DStateBlock9** dst)
 {
-    IDirect3DVertexShader9* vs;
-    IDirect3DPixelShader9* ps;
-    D3DMATRIX origProj, origProj2, origView, origView2, origWorld;
-
-    dev->GetVertexShader(&vs);
-    dev->GetPixelShader(&ps);
-
-    dev->SetVertexShader(nullptr);
-    dev->SetPixelShader(nullptr);
-
-    dev->GetTransform(D3DTS_PROJECTION_LEFT, &origProj);
-    dev->GetTransform(D3DTS_VIEW_LEFT, &origView);
-    dev->GetTransform(D3DTS_WORLD, &origWorld);
-
-    dev->SetTransform(D3DTS_PROJECTION_LEFT, proj);
-    dev->SetTransform(D3DTS_VIEW_LEFT, view);
-    if (dx::multiview_rendering_enabled()) {
-        dev->GetTransform(D3DTS_PROJECTION_RIGHT, &origProj2);
-        dev->GetTransform(D3DTS_VIEW_RIGHT, &origView2);
-        dev->SetTransform(D3DTS_PROJECTION_RIGHT, proj_multiview);
-        dev->SetTransform(D3DTS_VIEW_RIGHT, view);
+    if (dev->BeginStateBlock() != D3D_OK) {
+        return false;
     }
-    dev->SetTransform(D3DTS_WORLD, world);
-
-    dev->BeginScene();
 
-    IDirect3DBaseTexture9* origTex;
-    dev->GetTexture(0, &origTex);
+    dev->SetPixelShader(nullptr);
 
     dev->SetRenderState(D3DRS_ALPHABLENDENABLE, TRUE);
     dev->SetRenderState(D3DRS_SRCBLEND, D3DBLEND_SRCALPHA);
@@ -252,27 +361,100 @@ static void render_texture(
     dev->SetTextureStageState(0, D3DTSS_ALPHAOP, D3DTOP_SELECTARG1);
     dev->SetTextureStageState(0, D3DTSS_ALPHAARG1, D3DTA_TEXTURE);
 
-    dev->SetRenderState(D3DRS_ZENABLE, rbr::get_game_mode() == rbr::GameMode::MainMenu);
+    dev->SetRenderState(D3DRS_ZENABLE, z_enable);
 
-    dev->SetTexture(0, tex);
+    dev->SetFVF(D3DFVF_XYZ | D3DFVF_TEX1);
+
+    return dev->EndStateBlock(dst) == D3D_OK;
+}
+
+static bool create_quad_state_blocks(IDirect3DDevice9* dev)
+{
+    // The restore block is recorded with the same states. Only the set of states matters,
+    // the values are captured from the device before each draw.
+    return record_quad_state_block(dev, false, &g::quad_state_block[0])
+        && record_quad_state_block(dev, true, &g::quad_state_block[1])
+        && record_quad_state_block(dev, false, &g::quad_restore_state_block);
+}
+
+// Device state replaced while drawing textured quads
+struct QuadDrawState {
+    IDirect3DVertexShader9* vs;
+    IDirect3DBaseTexture9* tex;
+    D3DMATRIX proj, proj_multiview, view, view_multiview, world;
+};
+
+// Sets up the device for drawing `tex` with `vbuf`. Everything except the projection is shared by all quads drawn before end_quad_drawing.
+static QuadDrawState begin_quad_drawing(IDirect3DDevice9* dev, const D3DMATRIX* view, const D3DMATRIX* world, IDirect3DTexture9* tex, IDirect3DVertexBuffer9* vbuf)
+{
+    // The shader and texture are tracked by the hooks, so they don't need to be read from the device
+    QuadDrawState orig = {
+        .vs = dx::current_vertex_shader(),
+        .tex = dx::current_texture(0),
+    };
+
+    g::quad_restore_state_block->Capture();
+    dx::apply_untracked_state_block(g::quad_state_block[rbr::get_game_mode() == rbr::GameMode::MainMenu]);
+
+    dev->SetVertexShader(nullptr);
+
+    dev->GetTransform(D3DTS_PROJECTION_LEFT, &orig.proj);
+    dev->GetTransform(D3DTS_VIEW_LEFT, &orig.view);
+    dev->GetTransform(D3DTS_WORLD, &orig.world);
+
+    dev->SetTransform(D3DTS_VIEW_LEFT, view);
+    if (dx::multiview_rendering_enabled()) {
+        dev->GetTransform(D3DTS_PROJECTION_RIGHT, &orig.proj_multiview);
+        dev->GetTransform(D3DTS_VIEW_RIGHT, &orig.view_multiview);
+        dev->SetTransform(D3DTS_VIEW_RIGHT, view);
+    }
+    dev->SetTransform(D3DTS_WORLD, world);
+
+    dev->BeginScene();
 
+    dev->SetTexture(0, tex);
     dev->SetStreamSource(0, vbuf, 0, sizeof(Vertex));
-    dev->SetFVF(D3DFVF_XYZ | D3DFVF_TEX1);
+
+    return orig;
+}
+
+static void draw_quad(IDirect3DDevice9* dev, const D3DMATRIX* proj, const D3DMATRIX* proj_multiview)
+{
+    dev->SetTransform(D3DTS_PROJECTION_LEFT, proj);
+    if (dx::multiview_rendering_enabled()) {
+        dev->SetTransform(D3DTS_PROJECTION_RIGHT, proj_multiview);
+    }
     dev->DrawPrimitive(D3DPT_TRIANGLESTRIP, 0, 2);
+}
 
+static void end_quad_drawing(IDirect3DDevice9* dev, const QuadDrawState& orig)
+{
     dev->EndScene();
 
-    dev->SetRenderState(D3DRS_ZENABLE, true);
-    dev->SetTexture(0, origTex);
-    dev->SetVertexShader(vs);
-    dev->SetPixelShader(ps);
-    dev->SetTransform(D3DTS_PROJECTION_LEFT, &origProj);
-    dev->SetTransform(D3DTS_VIEW_LEFT, &origView);
+    dx::apply_untracked_state_block(g::quad_restore_state_block);
+    dev->SetTexture(0, orig.tex);
+    dev->SetVertexShader(orig.vs);
+    dev->SetTransform(D3DTS_PROJECTION_LEFT, &orig.proj);
+    dev->SetTransform(D3DTS_VIEW_LEFT, &orig.view);
     if (dx::multiview_rendering_enabled()) {
-        dev->SetTransform(D3DTS_PROJECTION_RIGHT, &origProj2);
-        dev->SetTransform(D3DTS_VIEW_RIGHT, &origView2);
+        dev->SetTransform(D3DTS_PROJECTION_RIGHT, &orig.proj_multiview);
+        dev->SetTransform(D3DTS_VIEW_RIGHT, &orig.view_multiview);
     }
-    dev->SetTransform(D3DTS_WORLD, &origWorld);
+    dev->SetTransform(D3DTS_WORLD, &orig.world);
+}
+
+static void render_texture(
+    IDirect3DDevice9* dev,
+    const D3DMATRIX* proj,
+    const D3DMATRIX* proj_multiview,
+    const D3DMATRIX* view,
+    const D3DMATRIX* world,
+    IDirect3DTexture9* tex,
+    IDirect3DVertexBuffer9* vbuf)
+{
+    const auto orig = begin_quad_drawing(dev, view, world, tex, vbuf);
+    draw_quad(dev, proj, proj_multiview);
+    end_quad_drawing(dev, orig);
 }
 
 void render_overlay_border(IDirect3DDevice9* dev, IDirect3DTexture9* tex)
@@ -280,25 +462,33 @@ void render_overlay_border(IDirect3DDevice9* dev, IDirect3DTexture9* tex)
     render_texture(dev, &g::identity_matrix, &g::identity_matrix, &g::identity_matrix, &g::identity_matrix, tex, g::overlay_border_quad);
 }
 
-void render_menu_quad(IDirect3DDevice9* dev, VRInterface* vr, IDirect3DTexture9* texture, RenderTarget render_target_3d, RenderTarget render_target_2d, float size, glm::vec3 translation, const std::optional<M4>& horizon_lock)
+void render_menu_quads(IDirect3DDevice9* dev, VRInterface* vr, IDirect3DTexture9* texture, std::span<const RenderTarget> views, RenderTarget render_target_2d, float size, glm::vec3 translation, bool horizon_lock, bool clear)
 {
-    const auto left = render_target_3d;
-
-    const auto& projectionl = vr->get_projection(left);
-    const auto& eyeposl = vr->get_eye_pos(left);
-    const auto& posel = vr->get_pose(left);
+    const auto& frame = vr->get_frame_matrices();
+    const auto mvp = [&](RenderTarget tgt) {
+        const auto& view = horizon_lock ? frame.view[tgt] : frame.view_without_horizon_lock[tgt];
+        return d3d_from_m4(vr->get_projection(tgt) * glm::translate(glm::scale(view, { size, size, 1.0f }), translation));
+    };
 
-    D3DMATRIX mvpr = { 0 };
-    if (dx::multiview_rendering_enabled()) {
-        const auto right = render_target_counterpart(left);
-        const auto& projectionr = vr->get_projection(right);
-        const auto& eyeposr = vr->get_eye_pos(right);
-        const auto& poser = vr->get_pose(right);
-        mvpr = d3d_from_m4(projectionr * glm::translate(glm::scale(eyeposr * poser * g::flip_z_matrix * horizon_lock.value_or(glm::identity<M4>()), { size, size, 1.0f }), translation));
+    // Calculate the matrices of all the views first, so the drawing for each view is just a render target change and a draw call
+    std::array<D3DMATRIX, 4> mvpl, mvpr = {};
+    for (size_t i = 0; i < views.size(); ++i) {
+        mvpl[i] = mvp(views[i]);
+        if (dx::multiview_rendering_enabled()) {
+            mvpr[i] = mvp(render_target_counterpart(views[i]));
+        }
     }
 
-    const D3DMATRIX mvpl = d3d_from_m4(projectionl * glm::translate(glm::scale(eyeposl * posel * g::flip_z_matrix * horizon_lock.value_or(glm::identity<M4>()), { size, size, 1.0f }), translation));
-    render_texture(dev, &mvpl, &mvpr, &g::identity_matrix, &g::identity_matrix, texture, g::quad_vertex_buf[render_target_2d == GameMenu ? 0 : 1]);
+    const auto orig = begin_quad_drawing(dev, &g::identity_matrix, &g::identity_matrix, texture, g::quad_vertex_buf[render_target_2d == GameMenu ? 0 : 1]);
+    for (size_t i = 0; i < views.size(); ++i) {
+        if (vr->prepare_vr_rendering(dev, views[i], clear)) {
+            draw_quad(dev, &mvpl[i], &mvpr[i]);
+            vr->finish_vr_rendering(dev, views[i]);
+        } else {
+            dbg(std::format("Failed to render overlay for view {}", static_cast<int>(views[i])));
+        }
+    }
+    end_quad_drawing(dev, orig);
 }
 
 void render_companion_window_from_render_target(IDirect3DDevice9* dev, VRInterface* vr, RenderTarget tgt)
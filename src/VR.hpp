@@ -9,6 +9,7 @@
 #include <openvr.h>
 #include <openxr.h>
 #include <optional>
+#include <span>
 #include <unordered_map>
 
 // We pass multiview view/projection matrices in D3DTS_WORLDMATRIX indices in
@@ -87,6 +88,11 @@ struct FrameTimingInfo {
     uint32_t reprojection_flags;
     uint32_t mispresented_frames;
     uint32_t dropped_frames;
+    // Time waited for the frame to begin and the age of the frame state the poses were predicted from (OpenXR)
+    float frame_wait;
+    float pose_age;
+    // Time waited for the cross-API fences on the CPU (OpenXR)
+    float fence_wait;
 };
 
 struct RenderContext {
@@ -106,20 +112,46 @@ struct RenderContext {
     bool quad_view_rendering;
     bool multiview_rendering;
 
+    // Approximate VRAM used by the context's own textures, in bytes. The render targets, which may be shared
+    // with other contexts, are not included.
+    uint64_t estimated_size = 0;
+    // Value of the use counter when the context was last set, for evicting the least recently used contexts
+    uint64_t last_used = 0;
+
     void* ext;
 };
 
+// Matrices that only change when the VR poses are updated, calculated once per frame
+// for each render target. The hooks multiply the game matrices with these.
+struct FrameMatrices {
+    // eye_pos * pose * flip_z * horizon_lock
+    M4 view[4];
+    // eye_pos * pose * flip_z
+    M4 view_without_horizon_lock[4];
+    // projection * eye_pos * pose * flip_z * horizon_lock
+    M4 view_projection[4];
+    // Inverse of the left eye HMD orientation, used to rotate the sky and fog
+    M4 sky_rotation;
+};
+
 class VRInterface {
 protected:
     std::unordered_map<std::string, RenderContext> render_contexts;
     std::string current_render_context_name;
     RenderContext* current_render_context;
+    uint64_t render_context_uses = 0;
 
     M4 hmd_pose[4];
     M4 eye_pos[4];
     M4 projection[4];
+    FrameMatrices frame_matrices;
 
     void init_surfaces(IDirect3DDevice9* dev, RenderContext& ctx, uint32_t res_x_2d, uint32_t res_y_2d);
+    // Creates the render context for the [gfx] entry `name` into render_contexts. Throws on failure,
+    // in which case the partially created context is left in render_contexts for release_render_context.
+    virtual void create_render_context(IDirect3DDevice9* dev, const std::string& name) = 0;
+    virtual void release_render_context(RenderContext& ctx);
+    void evict_render_contexts(const std::string& keep);
 
     static constexpr float z_near = 0.01f;
     static constexpr float z_far = 10000.0f;
@@ -152,7 +184,9 @@ public:
     }
     const M4& get_eye_pos(RenderTarget tgt) const { return eye_pos[tgt]; }
     const M4& get_pose(RenderTarget tgt) const { return hmd_pose[tgt]; }
-    IDirect3DTexture9* get_texture(RenderTarget tgt) const { return current_render_context->dx_texture[tgt]; }
+    const FrameMatrices& get_frame_matrices() const { return frame_matrices; }
+    void update_frame_matrices(const M4& horizon_lock);
+    virtual IDirect3DTexture9* get_texture(RenderTarget tgt) const { return current_render_context->dx_texture[tgt]; }
     RenderContext* get_current_render_context() const { return current_render_context; }
     const std::string& get_current_render_context_name() const { return current_render_context_name; }
     bool create_companion_window_buffer(IDirect3DDevice9* dev);
@@ -164,5 +198,7 @@ public:
 
 bool create_quad(IDirect3DDevice9* dev, float size, float aspect, IDirect3DVertexBuffer9** dst);
 void render_overlay_border(IDirect3DDevice9* dev, IDirect3DTexture9* tex);
-void render_menu_quad(IDirect3DDevice9* dev, VRInterface* vr, IDirect3DTexture9* texture, RenderTarget renderTarget3D, RenderTarget render_target_2d, float size, glm::vec3 translation, const std::optional<M4>& horizon_lock);
+// Renders the 2D texture on a plane to each of `views`, clearing the views first if `clear` is set.
+// The device is set up only once for all of the views. With multiview rendering each view also covers its counterpart.
+void render_menu_quads(IDirect3DDevice9* dev, VRInterface* vr, IDirect3DTexture9* texture, std::span<const RenderTarget> views, RenderTarget render_target_2d, float size, glm::vec3 translation, bool horizon_lock, bool clear);
 void render_companion_window_from_render_target(IDirect3DDevice9* dev, VRInterface* vr, RenderTarget tgt);
@@ -13,6 +13,7 @@
 #include "Globals.hpp"
 #include "Hook.hpp"
 #include "Licenses.hpp"
+#include "MatrixKernels.hpp"
 #include "Menu.hpp"
 #include "OpenVR.hpp"
 #include "OpenXR.hpp"
@@ -28,6 +29,7 @@ openRBRVR::openRBRVR(IRBRGame* g)
     : game(g)
 {
     g::game = g;
+    dbg(std::format("Using {} matrix kernels", matrix::implementation()));
     dbg("Hooking DirectX");
 
     auto d3ddll = GetModuleHandle("d3d9.dll");
@@ -0,0 +1,176 @@
+// Cost of finding the matrix passed in a BTB shader constant upload
+//
+// Replays a stream of constant uploads laid out like the ones of a BTB stage:
+// every draw uploads the matrices its shader reads, and some shaders also get
+// data that isn't any of the known matrices. Part of that data stays the same
+// for the whole stage, part of it changes on every draw. The learned table is
+// compared against classifying every upload, and against the table without
+// the hash of the BTBConstant::Other data.
+
+#include "BTBConstants.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+using Matrix = std::array<float, 16>;
+
+// Candidate matrices of one draw, indexed by BTBConstant
+using Candidates = std::array<Matrix, 8>;
+
+struct Upload {
+    uint32_t table;
+    uint32_t reg;
+    uint32_t vector4f_count;
+    uint32_t candidates;
+    BTBConstant expected;
+    std::array<float, 20> data;
+};
+
+struct Stream {
+    std::vector<Candidates> candidates;
+    std::vector<Upload> uploads;
+    uint32_t tables;
+};
+
+// Registers a shader reads and what is passed in them
+struct ShaderLayout {
+    struct Register {
+        uint32_t reg;
+        BTBConstant c;
+        uint32_t vector4f_count;
+        // For BTBConstant::Other, whether the data changes on every draw
+        bool per_draw;
+    };
+    std::vector<Register> registers;
+};
+
+static Matrix random_matrix(std::mt19937& rng)
+{
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    Matrix m;
+    for (auto& v : m) {
+        v = dist(rng);
+    }
+    return m;
+}
+
+static Stream record_stream(uint32_t frames, uint32_t draws_per_frame)
+{
+    using enum BTBConstant;
+    const std::vector<ShaderLayout> layouts = {
+        { { { 0, WorldViewProj, 4, false } } },
+        { { { 0, World, 4, false }, { 4, ViewProj, 4, false }, { 8, Other, 4, false } } },
+        { { { 0, WorldView, 4, false }, { 4, Projection, 4, false }, { 8, Other, 4, true } } },
+        { { { 0, ProjView, 5, false } } },
+        { { { 0, World, 4, false }, { 4, View, 4, false }, { 8, Projection, 4, false }, { 12, Other, 4, false } } },
+    };
+    constexpr uint32_t shaders = 40;
+
+    std::mt19937 rng(1);
+    Stream stream { .candidates = {}, .uploads = {}, .tables = shaders };
+    const auto stage_data = random_matrix(rng);
+    for (uint32_t frame = 0; frame < frames; ++frame) {
+        const auto projection = random_matrix(rng);
+        const auto view = random_matrix(rng);
+        const auto proj_view = random_matrix(rng);
+        const auto view_proj = random_matrix(rng);
+        for (uint32_t draw = 0; draw < draws_per_frame; ++draw) {
+            Candidates candidates;
+            candidates[static_cast<size_t>(World)] = random_matrix(rng);
+            candidates[static_cast<size_t>(Projection)] = projection;
+            candidates[static_cast<size_t>(View)] = view;
+            candidates[static_cast<size_t>(ProjView)] = proj_view;
+            candidates[static_cast<size_t>(ViewProj)] = view_proj;
+            candidates[static_cast<size_t>(WorldView)] = random_matrix(rng);
+            candidates[static_cast<size_t>(WorldViewProj)] = random_matrix(rng);
+            stream.candidates.push_back(candidates);
+
+            const auto shader = (draw * 7) % shaders;
+            for (const auto& r : layouts[shader % layouts.size()].registers) {
+                Upload upload {
+                    .table = shader,
+                    .reg = r.reg,
+                    .vector4f_count = r.vector4f_count,
+                    .candidates = static_cast<uint32_t>(stream.candidates.size() - 1),
+                    .expected = r.c,
+                    .data = {},
+                };
+                const auto& m = r.c == Other ? (r.per_draw ? random_matrix(rng) : stage_data) : candidates[static_cast<size_t>(r.c)];
+                std::copy(m.begin(), m.end(), upload.data.begin());
+                // Camera position after the matrix
+                upload.data[16] = upload.data[17] = upload.data[18] = upload.data[19] = static_cast<float>(frame);
+                stream.uploads.push_back(upload);
+            }
+        }
+    }
+    return stream;
+}
+
+struct Result {
+    double ns_per_upload;
+    double comparisons_per_upload;
+};
+
+template <typename F>
+static Result replay(const Stream& stream, int rounds, F find)
+{
+    size_t comparisons = 0;
+    size_t uploads = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; ++round) {
+        std::vector<BTBConstantTable> tables(stream.tables);
+        for (const auto& upload : stream.uploads) {
+            const auto& candidates = stream.candidates[upload.candidates];
+            const auto is_constant = [&](BTBConstant c) {
+                comparisons++;
+                return std::memcmp(upload.data.data(), candidates[static_cast<size_t>(c)].data(), sizeof(Matrix)) == 0;
+            };
+            const auto c = find(tables[upload.table][upload.reg], upload, is_constant);
+            if (c != upload.expected) {
+                std::printf("Upload %zu to register %u was classified as %d instead of %d\n",
+                    uploads % stream.uploads.size(), upload.reg, static_cast<int>(c), static_cast<int>(upload.expected));
+                std::exit(1);
+            }
+            uploads++;
+        }
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    return {
+        std::chrono::duration<double, std::nano>(elapsed).count() / uploads,
+        static_cast<double>(comparisons) / uploads,
+    };
+}
+
+int main()
+{
+    constexpr int rounds = 200;
+    const auto stream = record_stream(10, 300);
+
+    const auto classify = replay(stream, rounds, [](BTBConstantEntry&, const Upload&, const auto& is_constant) {
+        return classify_btb_constant(is_constant);
+    });
+    const auto unhashed = replay(stream, rounds, [](BTBConstantEntry& entry, const Upload&, const auto& is_constant) {
+        if (entry.constant != BTBConstant::Unknown && entry.constant != BTBConstant::Other && is_constant(entry.constant)) {
+            return entry.constant;
+        }
+        entry.constant = classify_btb_constant(is_constant);
+        return entry.constant;
+    });
+    const auto learned = replay(stream, rounds, [](BTBConstantEntry& entry, const Upload& upload, const auto& is_constant) {
+        bool classified;
+        return learn_btb_constant(entry, upload.data.data(), upload.vector4f_count, is_constant, classified);
+    });
+
+    std::printf("%zu uploads\n", stream.uploads.size());
+    std::printf("%-24s %16s %16s\n", "", "ns per upload", "comparisons");
+    std::printf("%-24s %16.2f %16.2f\n", "classify every upload", classify.ns_per_upload, classify.comparisons_per_upload);
+    std::printf("%-24s %16.2f %16.2f\n", "learned, Other unhashed", unhashed.ns_per_upload, unhashed.comparisons_per_upload);
+    std::printf("%-24s %16.2f %16.2f\n", "learned", learned.ns_per_upload, learned.comparisons_per_upload);
+
+    return 0;
+}
@@ -0,0 +1,288 @@
+// Tests for the pipelined OpenXR frame loop against the stub runtime
+//
+// The runtime is loaded from the manifest given as the first argument, and
+// negotiated with like the OpenXR loader does. The frame loop of the game is
+// simulated with sleeps: the simulation before the frame state is needed and
+// the rendering between xrBeginFrame and xrEndFrame. The frame loop is run
+// with xrWaitFrame called on the render thread and with the FramePacer, and
+// the CPU frame time, the time waited for the frame and the age of the frame
+// state at pose time are printed for both. Shutdown is tested with the pacer's
+// thread both in xrWaitFrame and waiting for the frame to be begun.
+
+#include "FramePacer.hpp"
+#include "XrLoaderNegotiation.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+using Clock = std::chrono::steady_clock;
+
+static int failures = 0;
+
+static void check(bool ok, const char* test, const char* what)
+{
+    if (!ok) {
+        std::printf("%s: %s\n", test, what);
+        failures++;
+    }
+}
+
+static float ms(Clock::duration d)
+{
+    return std::chrono::duration<float, std::milli>(d).count();
+}
+
+struct Runtime {
+    PFN_xrGetInstanceProcAddr get_instance_proc_addr;
+    PFN_xrCreateInstance create_instance;
+    PFN_xrDestroyInstance destroy_instance;
+    PFN_xrCreateSession create_session;
+    PFN_xrDestroySession destroy_session;
+    PFN_xrWaitFrame wait_frame;
+    PFN_xrBeginFrame begin_frame;
+    PFN_xrEndFrame end_frame;
+};
+
+static void* load_library(const std::filesystem::path& path)
+{
+#ifdef _WIN32
+    return LoadLibraryW(path.c_str());
+#else
+    return dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+#endif
+}
+
+static void* find_symbol(void* library, const char* name)
+{
+#ifdef _WIN32
+    return reinterpret_cast<void*>(GetProcAddress(static_cast<HMODULE>(library), name));
+#else
+    return dlsym(library, name);
+#endif
+}
+
+// Loads the runtime library of the manifest and negotiates with it
+static std::optional<Runtime> load_runtime(const std::filesystem::path& manifest_path)
+{
+    std::ifstream f(manifest_path);
+    std::stringstream ss;
+    ss << f.rdbuf();
+    const auto manifest = ss.str();
+
+    // Enough JSON parsing for the manifest build.zig writes
+    const auto key = manifest.find("\"library_path\"");
+    const auto begin = key == std::string::npos ? key : manifest.find('"', manifest.find(':', key));
+    const auto end = begin == std::string::npos ? begin : manifest.find('"', begin + 1);
+    if (end == std::string::npos) {
+        std::printf("No library_path in %s\n", manifest_path.string().c_str());
+        return std::nullopt;
+    }
+    const auto library_path = manifest_path.parent_path() / manifest.substr(begin + 1, end - begin - 1);
+
+    const auto library = load_library(library_path);
+    if (!library) {
+        std::printf("Could not load %s\n", library_path.string().c_str());
+        return std::nullopt;
+    }
+    const auto negotiate = reinterpret_cast<PFN_xrNegotiateLoaderRuntimeInterface>(find_symbol(library, "xrNegotiateLoaderRuntimeInterface"));
+    if (!negotiate) {
+        std::printf("No xrNegotiateLoaderRuntimeInterface in %s\n", library_path.string().c_str());
+        return std::nullopt;
+    }
+
+    const XrNegotiateLoaderInfo loader_info = {
+        .structType = XR_LOADER_INTERFACE_STRUCT_LOADER_INFO,
+        .structVersion = XR_LOADER_INFO_STRUCT_VERSION,
+        .structSize = sizeof(XrNegotiateLoaderInfo),
+        .minInterfaceVersion = 1,
+        .maxInterfaceVersion = XR_CURRENT_LOADER_RUNTIME_VERSION,
+        .minApiVersion = XR_MAKE_VERSION(1, 0, 0),
+        .maxApiVersion = XR_MAKE_VERSION(1, 0x3ff, 0xfff),
+    };
+    XrNegotiateRuntimeRequest request = {
+        .structType = XR_LOADER_INTERFACE_STRUCT_RUNTIME_REQUEST,
+        .structVersion = XR_RUNTIME_INFO_STRUCT_VERSION,
+        .structSize = sizeof(XrNegotiateRuntimeRequest),
+        .runtimeInterfaceVersion = 0,
+        .runtimeApiVersion = 0,
+        .getInstanceProcAddr = nullptr,
+    };
+    if (negotiate(&loader_info, &request) != XR_SUCCESS || !request.getInstanceProcAddr) {
+        std::printf("Negotiation with the runtime failed\n");
+        return std::nullopt;
+    }
+
+    Runtime rt {};
+    rt.get_instance_proc_addr = request.getInstanceProcAddr;
+    const auto get = [&](const char* name, auto& fn) {
+        PFN_xrVoidFunction f = nullptr;
+        rt.get_instance_proc_addr(XR_NULL_HANDLE, name, &f);
+        fn = reinterpret_cast<std::remove_reference_t<decltype(fn)>>(f);
+        check(fn != nullptr, "load", name);
+    };
+    get("xrCreateInstance", rt.create_instance);
+    get("xrDestroyInstance", rt.destroy_instance);
+    get("xrCreateSession", rt.create_session);
+    get("xrDestroySession", rt.destroy_session);
+    get("xrWaitFrame", rt.wait_frame);
+    get("xrBeginFrame", rt.begin_frame);
+    get("xrEndFrame", rt.end_frame);
+    return rt;
+}
+
+struct Timings {
+    float frame_time;
+    float frame_wait;
+    float pose_age;
+};
+
+// Simulation before the frame state is needed, and rendering after the poses are located
+struct Workload {
+    const char* name;
+    std::chrono::milliseconds simulation;
+    std::chrono::milliseconds rendering;
+};
+
+// Runs the frame loop the way OpenXR::update_vr_poses and OpenXR::prepare_frames_for_hmd do
+static Timings run_frames(const Runtime& rt, XrSession session, const Workload& work, bool pipelined, int frames)
+{
+    const auto test = pipelined ? "pipelined" : "serial";
+
+    std::optional<FramePacer> pacer;
+    if (pipelined) {
+        pacer.emplace([&](XrFrameState& state) { return rt.wait_frame(session, nullptr, &state); });
+    }
+
+    Clock::duration wait_total {}, pose_age_total {};
+    XrTime previous_display_time = 0;
+    // The first frames are left out of the timings, the pacer starts waiting before the first frame
+    constexpr int warmup = 10;
+    Clock::time_point start;
+    for (int i = 0; i < warmup + frames; ++i) {
+        if (i == warmup) {
+            start = Clock::now();
+            wait_total = pose_age_total = {};
+        }
+        std::this_thread::sleep_for(work.simulation);
+
+        const auto wait_start = Clock::now();
+        XrFrameState state = {
+            .type = XR_TYPE_FRAME_STATE,
+            .next = nullptr,
+        };
+        Clock::time_point state_time;
+        XrResult res;
+        if (pacer) {
+            res = pacer->take(state, state_time);
+        } else {
+            res = rt.wait_frame(session, nullptr, &state);
+            state_time = Clock::now();
+        }
+        wait_total += Clock::now() - wait_start;
+        check(res == XR_SUCCESS, test, "xrWaitFrame failed");
+        check(state.predictedDisplayTime > previous_display_time, test, "predicted display time didn't advance");
+        previous_display_time = state.predictedDisplayTime;
+
+        check(rt.begin_frame(session, nullptr) == XR_SUCCESS, test, "xrBeginFrame failed");
+        if (pacer) {
+            pacer->frame_begun();
+        }
+        // Poses are located here
+        pose_age_total += Clock::now() - state_time;
+
+        std::this_thread::sleep_for(work.rendering);
+        check(rt.end_frame(session, nullptr) == XR_SUCCESS, test, "xrEndFrame failed");
+    }
+
+    return {
+        ms(Clock::now() - start) / frames,
+        ms(wait_total) / frames,
+        ms(pose_age_total) / frames,
+    };
+}
+
+// Destroying the pacer must not wait for more than the xrWaitFrame in progress
+static void check_shutdown(const Runtime& rt, XrInstance instance, const char* test, bool begin)
+{
+    XrSession session = XR_NULL_HANDLE;
+    check(rt.create_session(instance, nullptr, &session) == XR_SUCCESS, test, "xrCreateSession failed");
+
+    std::optional<FramePacer> pacer;
+    pacer.emplace([&](XrFrameState& state) { return rt.wait_frame(session, nullptr, &state); });
+    XrFrameState state = {
+        .type = XR_TYPE_FRAME_STATE,
+        .next = nullptr,
+    };
+    Clock::time_point state_time;
+    check(pacer->take(state, state_time) == XR_SUCCESS, test, "xrWaitFrame failed");
+    if (begin) {
+        // The pacer's thread goes to xrWaitFrame for the next frame
+        check(rt.begin_frame(session, nullptr) == XR_SUCCESS, test, "xrBeginFrame failed");
+        pacer->frame_begun();
+    }
+    // Let the thread get to where it blocks
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    const auto shutdown_start = Clock::now();
+    pacer.reset();
+    const auto shutdown = Clock::now() - shutdown_start;
+
+    std::printf("%-32s %8.2f ms\n", test, ms(shutdown));
+    check(shutdown < std::chrono::milliseconds(50), test, "shutdown took too long");
+    check(rt.destroy_session(session) == XR_SUCCESS, test, "xrDestroySession failed");
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        std::printf("Usage: %s <runtime manifest>\n", argv[0]);
+        return 1;
+    }
+    const auto rt = load_runtime(argv[1]);
+    if (!rt || failures) {
+        return 1;
+    }
+
+    XrInstance instance = XR_NULL_HANDLE;
+    check(rt->create_instance(nullptr, &instance) == XR_SUCCESS, "instance", "xrCreateInstance failed");
+
+    // The stub runs at 90 Hz. The first workload fits in the display period, the second one doesn't.
+    constexpr int frames = 120;
+    const Workload workloads[] = {
+        { "9 ms", std::chrono::milliseconds(4), std::chrono::milliseconds(5) },
+        { "13 ms", std::chrono::milliseconds(6), std::chrono::milliseconds(7) },
+    };
+    std::printf("%-16s %16s %16s %16s\n", "", "frame time (ms)", "frame wait (ms)", "pose age (ms)");
+    for (const auto& work : workloads) {
+        for (const auto pipelined : { false, true }) {
+            XrSession session = XR_NULL_HANDLE;
+            check(rt->create_session(instance, nullptr, &session) == XR_SUCCESS, "session", "xrCreateSession failed");
+            const auto t = run_frames(*rt, session, work, pipelined, frames);
+            std::printf("%-6s %-9s %16.2f %16.2f %16.2f\n", work.name, pipelined ? "pipelined" : "serial", t.frame_time, t.frame_wait, t.pose_age);
+            check(rt->destroy_session(session) == XR_SUCCESS, "session", "xrDestroySession failed");
+        }
+    }
+
+    check_shutdown(*rt, instance, "shutdown in xrWaitFrame", true);
+    check_shutdown(*rt, instance, "shutdown waiting for begin", false);
+
+    check(rt->destroy_instance(instance) == XR_SUCCESS, "instance", "xrDestroyInstance failed");
+
+    if (failures) {
+        std::printf("%d failures\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,152 @@
+// Matrix kernels compared to the glm products they replaced
+//
+// Each kernel must produce the same bits as glm, as the BTB shader constants
+// are compared byte by byte against the matrices calculated with them. The
+// results of every available kernel are checked against glm before timing.
+// The operations timed are the ones of the two hot paths: the BTB comparison
+// matrices and the multiview MVP matrices of the base shaders.
+
+#include "MatrixKernels.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <glm.hpp>
+#include <gtc/type_ptr.hpp>
+#include <random>
+#include <vector>
+
+using M4 = glm::mat4x4;
+
+static M4 random_matrix(std::mt19937& rng)
+{
+    std::uniform_real_distribution<float> dist(-10.0f, 10.0f);
+    M4 m;
+    for (int i = 0; i < 16; ++i) {
+        glm::value_ptr(m)[i] = dist(rng);
+    }
+    return m;
+}
+
+static bool same(const M4& expected, const M4& actual, const char* kernel, const char* op, size_t i)
+{
+    if (memcmp(glm::value_ptr(expected), glm::value_ptr(actual), sizeof(M4)) == 0) {
+        return true;
+    }
+    std::printf("%s %s differs from glm for matrix %zu\n", kernel, op, i);
+    return false;
+}
+
+static bool check(const std::vector<M4>& matrices, const char* kernel)
+{
+    for (size_t i = 0; i + 2 < matrices.size(); ++i) {
+        const auto& a = matrices[i];
+        const auto& b = matrices[i + 1];
+        const auto& c = matrices[i + 2];
+
+        // In the D3DMATRIX layout a * b is b * a in glm
+        M4 out;
+        matrix::multiply(glm::value_ptr(a), glm::value_ptr(b), glm::value_ptr(out));
+        if (!same(b * a, out, kernel, "multiply", i)) {
+            return false;
+        }
+        matrix::multiply_transpose(glm::value_ptr(a), glm::value_ptr(b), glm::value_ptr(out));
+        if (!same(glm::transpose(b * a), out, kernel, "multiply_transpose", i)) {
+            return false;
+        }
+
+        M4 outs[2];
+        const float* rhs[] = { glm::value_ptr(b), glm::value_ptr(c) };
+        float* out_ptrs[] = { glm::value_ptr(outs[0]), glm::value_ptr(outs[1]) };
+        matrix::multiply_transpose_n(glm::value_ptr(a), rhs, out_ptrs, 2);
+        if (!same(glm::transpose(b * a), outs[0], kernel, "multiply_transpose_n", i) || !same(glm::transpose(c * a), outs[1], kernel, "multiply_transpose_n", i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename F>
+static double ns_per_op(const std::vector<M4>& matrices, int rounds, F op)
+{
+    // The results are stored like the real code stores them, so that none of the products are optimized away
+    std::vector<M4> results(matrices.size() * 4);
+    // Fastest of the rounds, the others are disturbed by whatever else runs on the machine
+    auto fastest = std::chrono::steady_clock::duration::max();
+    for (int round = 0; round < rounds; ++round) {
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i + 2 < matrices.size(); ++i) {
+            op(matrices[i], matrices[i + 1], matrices[i + 2], &results[4 * i]);
+        }
+        fastest = std::min(fastest, std::chrono::steady_clock::now() - start);
+    }
+    float sum = 0.0f;
+    for (const auto& m : results) {
+        sum += m[0][0];
+    }
+    if (sum == 1.0f) {
+        std::printf(" ");
+    }
+    return std::chrono::duration<double, std::nano>(fastest).count() / (matrices.size() - 2);
+}
+
+// BTB comparison matrices of one view, as update_btb_comparison_matrices calculates them
+static void comparison_glm(const M4& world, const M4& view, const M4& proj, M4* out)
+{
+    out[0] = glm::transpose(view * proj);
+    out[1] = glm::transpose(proj * view);
+    out[2] = glm::transpose(view * world);
+    out[3] = glm::transpose(proj * view * world);
+}
+
+static void comparison_kernels(const M4& world, const M4& view, const M4& proj, M4* out)
+{
+    M4 viewproj;
+    matrix::multiply(glm::value_ptr(view), glm::value_ptr(proj), glm::value_ptr(viewproj));
+    matrix::multiply_transpose(glm::value_ptr(proj), glm::value_ptr(view), glm::value_ptr(out[0]));
+    matrix::multiply_transpose(glm::value_ptr(view), glm::value_ptr(proj), glm::value_ptr(out[1]));
+    const float* rhs[] = { glm::value_ptr(view), glm::value_ptr(viewproj) };
+    float* outs[] = { glm::value_ptr(out[2]), glm::value_ptr(out[3]) };
+    matrix::multiply_transpose_n(glm::value_ptr(world), rhs, outs, 2);
+}
+
+// MVP matrices of both views from the shared MV matrix
+static void mvp_glm(const M4& mv, const M4& left, const M4& right, M4* out)
+{
+    out[0] = glm::transpose(left * mv);
+    out[1] = glm::transpose(right * mv);
+}
+
+static void mvp_kernels(const M4& mv, const M4& left, const M4& right, M4* out)
+{
+    const float* vp[] = { glm::value_ptr(left), glm::value_ptr(right) };
+    float* outs[] = { glm::value_ptr(out[0]), glm::value_ptr(out[1]) };
+    matrix::multiply_transpose_n(glm::value_ptr(mv), vp, outs, 2);
+}
+
+int main()
+{
+    constexpr int rounds = 200;
+    std::mt19937 rng(1);
+    std::vector<M4> matrices(4096);
+    for (auto& m : matrices) {
+        m = random_matrix(rng);
+    }
+
+    std::printf("%-8s %20s %20s\n", "", "comparison (ns)", "stereo MVP (ns)");
+    std::printf("%-8s %20.2f %20.2f\n", "glm", ns_per_op(matrices, rounds, comparison_glm), ns_per_op(matrices, rounds, mvp_glm));
+
+    for (const auto kernel : { "SSE2", "AVX2" }) {
+        if (!matrix::select(kernel)) {
+            std::printf("%-8s %20s %20s\n", kernel, "unsupported", "unsupported");
+            continue;
+        }
+        if (!check(matrices, kernel)) {
+            return 1;
+        }
+        std::printf("%-8s %20.2f %20.2f\n", kernel, ns_per_op(matrices, rounds, comparison_kernels), ns_per_op(matrices, rounds, mvp_kernels));
+    }
+
+    return 0;
+}
@@ -0,0 +1,156 @@
+// Tests for the shader bytecode parser
+//
+// The shaders are hand-assembled token streams in the same layout the shader
+// compiler outputs, with the assembly next to each instruction.
+
+#include "ShaderBytecode.hpp"
+
+#include <cstdio>
+#include <iterator>
+#include <vector>
+
+// clang-format off
+static constexpr uint32_t vs_1_1_shader[] = {
+    0xfffe0101,                                                  // vs_1_1
+    0x0004fffe, 0x42415443, 0x0000001c, 0x0000ffff, 0x00000000,  // comment block with an end token value inside
+    0x0000001f, 0x80000000, 0x900f0000,                          // dcl_position v0
+    0x0000001f, 0x80000005, 0x900f0001,                          // dcl_texcoord v1
+    0x00000051, 0xa00f0014, 0x3f800000, 0x00000000, 0x3f000000, 0x00000000, // def c20, 1, 0, 0.5, 0
+    0x00000014, 0xc00f0000, 0x90e40000, 0xa0e40000,              // m4x4 oPos, v0, c0
+    0x00000017, 0x80070000, 0x90e40001, 0xa0e40004,              // m3x3 r0.xyz, v1, c4
+    0x00000009, 0xe0010000, 0x90e40000, 0xa0e4000c,              // dp4 oT0.x, v0, c12
+    0x00000004, 0xd00f0000, 0x80e40000, 0xa0000007, 0xa0e40008,  // mad oD0, r0, c7.x, c8
+    0x0000ffff,                                                  // end
+};
+
+static constexpr uint32_t vs_1_1_relative_shader[] = {
+    0xfffe0101,                                                  // vs_1_1
+    0x0000001f, 0x80000000, 0x900f0000,                          // dcl_position v0
+    0x0000001f, 0x80000005, 0x900f0001,                          // dcl_texcoord v1
+    0x00000001, 0xb0010000, 0x90000001,                          // mov a0.x, v1.x
+    0x00000014, 0xc00f0000, 0x90e40000, 0xa0e40000,              // m4x4 oPos, v0, c0
+    0x00000001, 0xe00f0000, 0xa0e4200a,                          // mov oT0, c[a0.x + 10]
+    0x0000ffff,                                                  // end
+};
+
+static constexpr uint32_t vs_2_0_shader[] = {
+    0xfffe0200,                                                  // vs_2_0
+    0x0005fffe, 0x42415443, 0x0000001c, 0x00000023, 0xfffe0200, 0x0000ffff, // comment block
+    0x05000051, 0xa00f001e, 0x3f800000, 0x40000000, 0x40400000, 0x40800000, // def c30, 1, 2, 3, 4
+    0x05000030, 0xf00f0000, 0x00000004, 0x00000000, 0x00000001, 0x00000000, // defi i0, 4, 0, 1, 0
+    0x0200001f, 0x80000000, 0x900f0000,                          // dcl_position v0
+    0x0200002e, 0xb0010000, 0x90000000,                          // mova a0.x, v0.x
+    0x03000014, 0xc00f0000, 0x90e40000, 0xa0e40000,              // m4x4 oPos, v0, c0
+    0x03000001, 0xe00f0000, 0xa0e42028, 0xb0000000,              // mov oT0, c[a0.x + 40]
+    0x02000001, 0x800f0000, 0xa0e40002,                          // mov r0, c2
+    0x01000026, 0xf0e40000,                                      // rep i0
+    0x03000002, 0x800f0000, 0x80e40000, 0xa0e40005,              //   add r0, r0, c5
+    0x00000027,                                                  // endrep
+    0x02000001, 0xd00f0000, 0x80e40000,                          // mov oD0, r0
+    0x0000ffff,                                                  // end
+};
+
+static constexpr uint32_t vs_3_0_shader[] = {
+    0xfffe0300,                                                  // vs_3_0
+    0x0002fffe, 0x42415443, 0x0000001c,                          // comment block
+    0x05000030, 0xf00f0000, 0x00000004, 0x00000000, 0x00000001, 0x00000000, // defi i0, 4, 0, 1, 0
+    0x0200001f, 0x80000000, 0x900f0000,                          // dcl_position v0
+    0x0200001f, 0x80000000, 0xe00f0000,                          // dcl_position o0
+    0x0200001f, 0x80000005, 0xe0070001,                          // dcl_texcoord o1.xyz
+    0x0200001f, 0x8000000a, 0xe00f0002,                          // dcl_color o2
+    0x03000014, 0xe00f0000, 0x90e40000, 0xa0e40000,              // m4x4 o0, v0, c0
+    0x03000015, 0xe0070001, 0x90e40000, 0xa0e40014,              // m4x3 o1.xyz, v0, c20
+    0x02000001, 0x800f0000, 0x90e40000,                          // mov r0, v0
+    0x0200001b, 0xf0e40800, 0xf0e40000,                          // loop aL, i0
+    0x0201002d, 0xa000000c, 0x80000000,                          //   breakc_gt c12.x, r0.x
+    0x0301005e, 0xb0011000, 0x80000000, 0xa000000f,              //   setp_gt p0.x, r0.x, c15.x
+    0x01000060, 0xb0001000,                                      //   breakp p0.x
+    0x03000002, 0x800f0000, 0x80e40000, 0xa0e4000d,              //   add r0, r0, c13
+    0x0000001d,                                                  // endloop
+    0x02040029, 0xa0000028, 0xa000000b,                          // ifc_lt c40.x, c11.x
+    0x02000001, 0xe00f0002, 0xa0e4000e,                          //   mov o2, c14
+    0x0000002a,                                                  // else
+    0x02000001, 0xe00f0002, 0x80e40000,                          //   mov o2, r0
+    0x0000002b,                                                  // endif
+    0x01000028, 0xe0e40800,                                      // if b0
+    0x03000002, 0xe00f0002, 0x80e40000, 0xa0e40010,              //   add o2, r0, c16
+    0x0000002b,                                                  // endif
+    0x0000ffff,                                                  // end
+};
+// clang-format on
+
+static int failures = 0;
+
+static void check(bool ok, const char* shader, const char* what)
+{
+    if (!ok) {
+        std::printf("%s: %s\n", shader, what);
+        failures++;
+    }
+}
+
+template <size_t N>
+static void check_shader(const char* name, const uint32_t (&bytecode)[N], uint32_t major, uint32_t minor, const std::vector<uint32_t>& registers, uint32_t register_count, bool relative)
+{
+    const auto info = dxso::analyze(bytecode);
+    check(info.has_value(), name, "analysis failed");
+    if (!info) {
+        return;
+    }
+
+    check(info->is_vertex_shader, name, "not a vertex shader");
+    check(info->major_version == major && info->minor_version == minor, name, "wrong version");
+    check(info->length == N, name, "wrong length");
+    check(info->constant_registers == registers, name, "wrong constant registers");
+    check(info->constant_register_count == register_count, name, "wrong constant register count");
+    check(info->relative_addressing == relative, name, "wrong relative addressing");
+
+    // The length must come from the end token, not from the size of the buffer
+    std::vector<uint32_t> padded(std::begin(bytecode), std::end(bytecode));
+    padded.insert(padded.end(), { 0x0000ffff, 0x12345678 });
+    const auto padded_info = dxso::analyze(padded);
+    check(padded_info && padded_info->length == N, name, "wrong length with data after the end token");
+
+    // Any truncation must be detected instead of reading past the end
+    for (size_t i = 0; i < N; ++i) {
+        check(!dxso::analyze({ bytecode, i }), name, "truncated bytecode accepted");
+    }
+}
+
+int main()
+{
+    // Comments may contain the end token, definitions don't read the registers they define,
+    // and the matrix instructions read a register for each row
+    check_shader("vs_1_1", vs_1_1_shader, 1, 1, { 0, 1, 2, 3, 4, 5, 6, 7, 8, 12 }, 13, false);
+
+    // Relative addressing may read any of the 96 registers of vs_1_1
+    check_shader("vs_1_1 relative", vs_1_1_relative_shader, 1, 1, { 0, 1, 2, 3, 10 }, 96, true);
+
+    // The address register token after a relatively addressed source is skipped, and integer constants are not
+    // float constants
+    check_shader("vs_2_0", vs_2_0_shader, 2, 0, { 0, 1, 2, 3, 5, 40 }, 256, true);
+
+    // The flow control instructions have no destination, so their first parameter is a source
+    check_shader("vs_3_0", vs_3_0_shader, 3, 0, { 0, 1, 2, 3, 11, 12, 13, 14, 15, 16, 20, 21, 22, 40 }, 41, false);
+
+    constexpr uint32_t pixel_shader[] = { 0xffff0200, 0x0000ffff };
+    const auto ps = dxso::analyze(pixel_shader);
+    check(ps && !ps->is_vertex_shader && ps->constant_register_count == 0, "ps_2_0", "wrong analysis");
+
+    constexpr uint32_t unknown_version[] = { 0x12340101, 0x0000ffff };
+    check(!dxso::analyze(unknown_version), "unknown version", "accepted");
+
+    constexpr uint32_t unsupported_version[] = { 0xfffe0400, 0x0000ffff };
+    check(!dxso::analyze(unsupported_version), "vs_4_0", "accepted");
+
+    // Shader model 1.x instructions have no length field, so unknown opcodes can't be skipped
+    constexpr uint32_t unknown_opcode[] = { 0xfffe0101, 0x00000063, 0x0000ffff };
+    check(!dxso::analyze(unknown_opcode), "vs_1_1 unknown opcode", "accepted");
+
+    check(!dxso::analyze({}), "empty", "accepted");
+
+    if (failures == 0) {
+        std::printf("All shader bytecode tests passed\n");
+    }
+    return failures == 0 ? 0 : 1;
+}
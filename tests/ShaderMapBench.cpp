@@ -0,0 +1,80 @@
+// Lookup cost of ShaderMap compared to the linear search it replaced
+//
+// The shaders are fake pointers to heap blocks of about the size of the DXVK
+// shader objects. The ShaderMap lookup should stay flat as the number of
+// shaders grows, while the linear search grows with it.
+
+#include "ShaderMap.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <vector>
+
+struct FakeShaders {
+    std::vector<std::unique_ptr<char[]>> blocks;
+
+    IDirect3DVertexShader9* create()
+    {
+        blocks.push_back(std::make_unique<char[]>(0x60 + (blocks.size() % 4) * 0x10));
+        return reinterpret_cast<IDirect3DVertexShader9*>(blocks.back().get());
+    }
+};
+
+template <typename F>
+static double ns_per_lookup(const std::vector<IDirect3DVertexShader9*>& lookups, F find)
+{
+    size_t found = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (auto shader : lookups) {
+        found += find(shader) ? 1 : 0;
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    if (found != lookups.size()) {
+        std::printf("Lookup failed: found %zu of %zu shaders\n", found, lookups.size());
+        std::exit(1);
+    }
+    return std::chrono::duration<double, std::nano>(elapsed).count() / lookups.size();
+}
+
+int main()
+{
+    constexpr size_t lookup_count = 1 << 20;
+    std::mt19937 rng(1);
+
+    std::printf("%8s %16s %16s\n", "shaders", "ShaderMap (ns)", "std::find (ns)");
+    for (size_t count : { 8, 32, 128, 512, 2048, 8192 }) {
+        FakeShaders fake;
+        ShaderMap map;
+        std::vector<IDirect3DVertexShader9*> list;
+        for (size_t i = 0; i < count; ++i) {
+            const auto shader = fake.create();
+            map.insert(shader, ShaderInfo { .multiview = fake.create(), .cls = ShaderClass::BTB });
+            list.push_back(shader);
+        }
+
+        std::uniform_int_distribution<size_t> dist(0, count - 1);
+        std::vector<IDirect3DVertexShader9*> lookups(lookup_count);
+        std::generate(lookups.begin(), lookups.end(), [&] { return list[dist(rng)]; });
+
+        const auto map_ns = ns_per_lookup(lookups, [&](auto shader) { return map.find(shader) != nullptr; });
+        const auto list_ns = ns_per_lookup(lookups, [&](auto shader) { return std::find(list.begin(), list.end(), shader) != list.end(); });
+        std::printf("%8zu %16.2f %16.2f\n", count, map_ns, list_ns);
+
+        // Removing the shaders like free_btb_shaders does must leave the rest reachable
+        for (size_t i = 0; i < count; i += 2) {
+            map.erase(list[i]);
+        }
+        for (size_t i = 0; i < count; ++i) {
+            if ((map.find(list[i]) != nullptr) != (i % 2 == 1)) {
+                std::printf("Wrong lookup result after erase for shader %zu of %zu\n", i, count);
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,90 @@
+// Tests for the shader map and the fallback to the original shader
+//
+// The shaders are fake pointers, the map never dereferences them. The fallback
+// is tested for a base shader whose multiview copy couldn't be created, in which
+// case the copy is the shader itself, and for one whose copy couldn't be patched.
+
+#include "ShaderMap.hpp"
+
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+static int failures = 0;
+
+static void check(bool ok, const char* test, const char* what)
+{
+    if (!ok) {
+        std::printf("%s: %s\n", test, what);
+        failures++;
+    }
+}
+
+struct FakeShaders {
+    std::vector<std::unique_ptr<char[]>> blocks;
+
+    IDirect3DVertexShader9* create()
+    {
+        blocks.push_back(std::make_unique<char[]>(0x60));
+        return reinterpret_cast<IDirect3DVertexShader9*>(blocks.back().get());
+    }
+};
+
+static void check_fallback(const char* test, const ShaderMap& shaders, IDirect3DVertexShader9* shader, uint32_t register_count)
+{
+    const auto info = shaders.find(shader);
+    check(info != nullptr, test, "shader not found after the fallback");
+    if (!info) {
+        return;
+    }
+    check(info->multiview == shader, test, "shader doesn't bind itself");
+    check(!info->is_multiview, test, "shader marked as multiview");
+    check(info->cls == ShaderClass::Base, test, "wrong class");
+    check(info->constant_register_count == register_count && info->constant_usage_known, test, "wrong constant usage");
+}
+
+int main()
+{
+    FakeShaders fake;
+    ShaderMap shaders;
+
+    // Enough shaders that the erased entries have others after them in their probe sequences
+    std::vector<IDirect3DVertexShader9*> originals;
+    std::vector<IDirect3DVertexShader9*> copies;
+    for (uint32_t i = 0; i < 40; ++i) {
+        const auto original = fake.create();
+        originals.push_back(original);
+        if (i % 2 == 0) {
+            // Creating the copy failed, the shader is its own copy like in CreateVertexShader
+            copies.push_back(original);
+            shaders.insert(original, { original, ShaderClass::Base, false, i, true });
+        } else {
+            const auto copy = fake.create();
+            copies.push_back(copy);
+            shaders.insert(original, { copy, ShaderClass::Base, false, i, true });
+            shaders.insert(copy, { copy, ShaderClass::Base, true, i, true });
+        }
+    }
+
+    for (uint32_t i = 0; i < originals.size(); ++i) {
+        fall_back_to_original_shader(shaders, originals[i], copies[i]);
+    }
+
+    for (uint32_t i = 0; i < originals.size(); ++i) {
+        check_fallback(i % 2 == 0 ? "failed copy" : "failed patch", shaders, originals[i], i);
+        if (copies[i] != originals[i]) {
+            check(shaders.find(copies[i]) == nullptr, "failed patch", "copy not erased");
+        }
+    }
+    check(shaders.size() == originals.size(), "fallback", "wrong number of shaders");
+
+    // A shader that isn't in the map is left alone
+    const auto unknown = fake.create();
+    fall_back_to_original_shader(shaders, unknown, unknown);
+    check(shaders.find(unknown) == nullptr && shaders.size() == originals.size(), "unknown shader", "map changed");
+
+    if (failures == 0) {
+        std::printf("All shader map tests passed\n");
+    }
+    return failures == 0 ? 0 : 1;
+}
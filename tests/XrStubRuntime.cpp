@@ -0,0 +1,207 @@
+// Stand-in OpenXR runtime for running the frame loop without a headset
+//
+// Implements only what the frame loop calls: instance and session creation and
+// xrWaitFrame, xrBeginFrame and xrEndFrame. xrWaitFrame throttles to a 90 Hz
+// display, the frames start on the display period grid like they would with a
+// compositor. Where a real runtime would block the caller on a call order
+// violation, this one fails with XR_ERROR_CALL_ORDER_INVALID so that the tests
+// see it. It is loaded with the manifest build.zig writes next to it, either by
+// the tests or by the OpenXR loader through XR_RUNTIME_JSON.
+
+#define XR_NO_PROTOTYPES
+#include "XrLoaderNegotiation.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+#ifdef _WIN32
+#define XR_STUB_EXPORT extern "C" __declspec(dllexport)
+#else
+#define XR_STUB_EXPORT extern "C" __attribute__((visibility("default")))
+#endif
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    constexpr auto display_period = std::chrono::nanoseconds(1'000'000'000 / 90);
+
+    struct {
+        std::mutex mtx;
+        bool instance = false;
+        bool session = false;
+        // Frame returned by xrWaitFrame, not begun yet
+        bool waited = false;
+        // Frame begun with xrBeginFrame, not ended yet
+        bool begun = false;
+        Clock::time_point last_wake;
+    } g;
+
+    template <typename Handle>
+    Handle stub_handle()
+    {
+        if constexpr (std::is_pointer_v<Handle>) {
+            return reinterpret_cast<Handle>(uintptr_t { 1 });
+        } else {
+            return Handle { 1 };
+        }
+    }
+
+    XrTime to_xr_time(Clock::time_point t)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+    }
+
+    XRAPI_ATTR XrResult XRAPI_CALL create_instance(const XrInstanceCreateInfo*, XrInstance* instance)
+    {
+        std::lock_guard lock(g.mtx);
+        if (g.instance) {
+            return XR_ERROR_LIMIT_REACHED;
+        }
+        g.instance = true;
+        *instance = stub_handle<XrInstance>();
+        return XR_SUCCESS;
+    }
+
+    XRAPI_ATTR XrResult XRAPI_CALL destroy_instance(XrInstance)
+    {
+        std::lock_guard lock(g.mtx);
+        g.instance = false;
+        return XR_SUCCESS;
+    }
+
+    XRAPI_ATTR XrResult XRAPI_CALL create_session(XrInstance, const XrSessionCreateInfo*, XrSession* session)
+    {
+        std::lock_guard lock(g.mtx);
+        if (!g.instance) {
+            return XR_ERROR_HANDLE_INVALID;
+        }
+        if (g.session) {
+            return XR_ERROR_LIMIT_REACHED;
+        }
+        g.session = true;
+        g.waited = false;
+        g.begun = false;
+        g.last_wake = {};
+        *session = stub_handle<XrSession>();
+        return XR_SUCCESS;
+    }
+
+    XRAPI_ATTR XrResult XRAPI_CALL destroy_session(XrSession)
+    {
+        std::lock_guard lock(g.mtx);
+        g.session = false;
+        return XR_SUCCESS;
+    }
+
+    XRAPI_ATTR XrResult XRAPI_CALL wait_frame(XrSession, const XrFrameWaitInfo*, XrFrameState* state)
+    {
+        Clock::time_point wake;
+        {
+            std::lock_guard lock(g.mtx);
+            if (!g.session) {
+                return XR_ERROR_HANDLE_INVALID;
+            }
+            if (g.waited) {
+                return XR_ERROR_CALL_ORDER_INVALID;
+            }
+
+            // Next point on the display period grid, at least one period after the previous frame
+            const auto now = Clock::now();
+            const auto periods = (now.time_since_epoch() + display_period - std::chrono::nanoseconds(1)) / display_period;
+            wake = std::max(Clock::time_point(std::chrono::duration_cast<Clock::duration>(periods * display_period)), g.last_wake + display_period);
+            g.last_wake = wake;
+            g.waited = true;
+        }
+
+        std::this_thread::sleep_until(wake);
+
+        state->predictedDisplayTime = to_xr_time(wake + display_period);
+        state->predictedDisplayPeriod = display_period.count();
+        state->shouldRender = XR_TRUE;
+        return XR_SUCCESS;
+    }
+
+    XRAPI_ATTR XrResult XRAPI_CALL begin_frame(XrSession, const XrFrameBeginInfo*)
+    {
+        std::lock_guard lock(g.mtx);
+        if (!g.session) {
+            return XR_ERROR_HANDLE_INVALID;
+        }
+        if (!g.waited) {
+            return XR_ERROR_CALL_ORDER_INVALID;
+        }
+        g.waited = false;
+        if (g.begun) {
+            // The previous frame was never ended
+            return XR_FRAME_DISCARDED;
+        }
+        g.begun = true;
+        return XR_SUCCESS;
+    }
+
+    XRAPI_ATTR XrResult XRAPI_CALL end_frame(XrSession, const XrFrameEndInfo*)
+    {
+        std::lock_guard lock(g.mtx);
+        if (!g.session) {
+            return XR_ERROR_HANDLE_INVALID;
+        }
+        if (!g.begun) {
+            return XR_ERROR_CALL_ORDER_INVALID;
+        }
+        g.begun = false;
+        return XR_SUCCESS;
+    }
+
+    XRAPI_ATTR XrResult XRAPI_CALL get_instance_proc_addr(XrInstance, const char* name, PFN_xrVoidFunction* function)
+    {
+        struct Entry {
+            const char* name;
+            PFN_xrVoidFunction function;
+        };
+        static const Entry entries[] = {
+            { "xrGetInstanceProcAddr", reinterpret_cast<PFN_xrVoidFunction>(get_instance_proc_addr) },
+            { "xrCreateInstance", reinterpret_cast<PFN_xrVoidFunction>(create_instance) },
+            { "xrDestroyInstance", reinterpret_cast<PFN_xrVoidFunction>(destroy_instance) },
+            { "xrCreateSession", reinterpret_cast<PFN_xrVoidFunction>(create_session) },
+            { "xrDestroySession", reinterpret_cast<PFN_xrVoidFunction>(destroy_session) },
+            { "xrWaitFrame", reinterpret_cast<PFN_xrVoidFunction>(wait_frame) },
+            { "xrBeginFrame", reinterpret_cast<PFN_xrVoidFunction>(begin_frame) },
+            { "xrEndFrame", reinterpret_cast<PFN_xrVoidFunction>(end_frame) },
+        };
+
+        for (const auto& e : entries) {
+            if (std::strcmp(e.name, name) == 0) {
+                *function = e.function;
+                return XR_SUCCESS;
+            }
+        }
+        *function = nullptr;
+        return XR_ERROR_FUNCTION_UNSUPPORTED;
+    }
+}
+
+XR_STUB_EXPORT XrResult XRAPI_CALL xrNegotiateLoaderRuntimeInterface(const XrNegotiateLoaderInfo* loader_info, XrNegotiateRuntimeRequest* runtime_request)
+{
+    if (!loader_info || !runtime_request
+        || loader_info->structType != XR_LOADER_INTERFACE_STRUCT_LOADER_INFO
+        || loader_info->structVersion != XR_LOADER_INFO_STRUCT_VERSION
+        || loader_info->structSize != sizeof(XrNegotiateLoaderInfo)
+        || runtime_request->structType != XR_LOADER_INTERFACE_STRUCT_RUNTIME_REQUEST
+        || runtime_request->structVersion != XR_RUNTIME_INFO_STRUCT_VERSION
+        || runtime_request->structSize != sizeof(XrNegotiateRuntimeRequest)
+        || loader_info->minInterfaceVersion > XR_CURRENT_LOADER_RUNTIME_VERSION
+        || loader_info->maxInterfaceVersion < XR_CURRENT_LOADER_RUNTIME_VERSION
+        || loader_info->minApiVersion > XR_CURRENT_API_VERSION
+        || loader_info->maxApiVersion < XR_MAKE_VERSION(1, 0, 0)) {
+        return XR_ERROR_INITIALIZATION_FAILED;
+    }
+
+    runtime_request->runtimeInterfaceVersion = XR_CURRENT_LOADER_RUNTIME_VERSION;
+    runtime_request->runtimeApiVersion = XR_CURRENT_API_VERSION;
+    runtime_request->getInstanceProcAddr = get_instance_proc_addr;
+    return XR_SUCCESS;
+}